@@ -33,6 +33,7 @@
 
     #include "configuration.h"
     #include "USART.h"
+    #include "USART_instance.h"                                     // the USART driver - include once, in the sketch only
     #include "AVR_adc.h"
 
 // Global variables
@@ -83,17 +84,7 @@ void setup(){
  *
  ********************************************************************************/
 
-ISR(USART_RX_vect){
-
- /**
- * @note This Interrupt Service Routine is called when a new character is received by the USART.
- * Ideally it would have been placed in the USART.cpp file but there is a error "multiple definition
- * of vector_18".  Apparently Arduino detects when an ISR is in the main sketch.  If you place it
- * somewhere else it is missed and replaced with the Arduino handler.  This is the source of the
- * multiple definitions error -  * see discussion @ http://forum.arduino.cc/index.php?topic=42153.0
- */
-    USART_handle_ISR();
-}
+// The USART interrupt service routines are defined by USART_instance.h
 
 
 
@@ -0,0 +1,71 @@
+/**
+ * @file Arduino_host.cpp
+ *
+ * @brief The parts of the Arduino core used by the sketchbook, for Linux builds.
+ *
+ * Time is simulated in microseconds.  delay() and delayMicroseconds() advance the clock by the
+ * requested amount.  Each call to millis() or micros() advances it by 1 uS so that polling loops
+ * make progress.  Every call lets the hardware models run.
+ */
+
+    #include <stdint.h>
+
+    #include <Arduino.h>
+    #include "USART_host.h"
+
+
+// Public variables defined
+
+    volatile uint8_t host_io[0x200];
+    uint8_t host_pins[32];
+    unsigned long long host_time_us = 0;
+
+
+
+    void pinMode(uint8_t pin, uint8_t mode){
+
+        (void) pin;
+        (void) mode;
+    }
+
+
+    void digitalWrite(uint8_t pin, uint8_t val){
+
+        host_pins[pin & 0x1F] = val;
+    }
+
+
+    int digitalRead(uint8_t pin){
+
+        return host_pins[pin & 0x1F];
+    }
+
+
+    unsigned long micros(void){
+
+        host_time_us++;
+        host_USART_service();
+        return (unsigned long) host_time_us;
+    }
+
+
+    unsigned long millis(void){
+
+        host_time_us++;
+        host_USART_service();
+        return (unsigned long) (host_time_us / 1000);
+    }
+
+
+    void delay(unsigned long ms){
+
+        host_time_us += ms * 1000ULL;
+        host_USART_service();
+    }
+
+
+    void delayMicroseconds(unsigned int us){
+
+        host_time_us += us;
+        host_USART_service();
+    }
@@ -0,0 +1,424 @@
+/**
+ * @file USART_host.cpp
+ *
+ * @brief The USART0 hardware model for Linux builds.  See USART_host.h.
+ *
+ * Timer2 is also modeled here.  It is the silence timer of the USART when a sketch defines
+ * USART_FRAME_TIMER.  It counts simulated time in CTC mode and calls TIMER2_COMPA_vect on a
+ * compare match.
+ */
+
+    #define _XOPEN_SOURCE 600
+
+    #include <stdint.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+
+    #include <Arduino.h>
+    #include <avr/io.h>
+    #include <avr/interrupt.h>
+
+    #include "USART_host.h"
+
+
+    #define HOST_BUF_LEN 4096
+
+    extern "C" void USART_RX_vect(void);
+    extern "C" void USART_UDRE_vect(void);
+    extern "C" void USART_TX_vect(void) __attribute__((weak));     // not defined when the sketch supplies its own ISRs
+    extern "C" void TIMER2_COMPA_vect(void) __attribute__((weak)); // only defined by sketches that use the frame timer
+
+    extern unsigned long long host_time_us;
+
+
+// Public variables defined
+
+    host_regs_t host_USART0_regs;
+
+
+// Private variables
+
+    static uint8_t rx_queue[HOST_BUF_LEN];                          // characters "on the wire" toward the USART
+    static uint16_t rx_head = 0;
+    static uint16_t rx_tail = 0;
+
+    static char tx_capture[HOST_BUF_LEN];                           // characters sent by the USART
+    static uint16_t tx_len = 0;
+
+    static uint8_t loopback = 0;
+    static int pty_fd = -1;
+    static uint8_t in_service = 0;
+    static void (*attached_device)(void) = 0;
+    static unsigned long rx_char_us = 0;                            // see host_USART_pace
+    static unsigned long long rx_next_us = 0;
+    static unsigned long tx_char_us = 0;                            // see host_USART_pace_tx
+    static unsigned long long tx_free_us = 0;                       // the last character written leaves the line
+    static unsigned long long tx_drained_us = 0;                    // the UDRE ISR last had the chance to run
+    static unsigned long long tx_at_us = 0;                         // simulated time of the write in progress
+    static uint8_t tx_late = 0;                                     // the write happened at tx_at_us, not now
+
+    static unsigned long long timer2_last_us = 0;
+    static const uint16_t timer2_prescale[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+
+// Private functions
+
+    static void timer2_service(void);
+    static void TX_complete(void);
+    static uint8_t tx_flags(void);
+    static void tx_drain(void);
+    static uint8_t rx_enabled(void);
+    static void rx_deliver(void);
+
+
+
+/**
+ * @brief Called by the UDR model on every write.
+ */
+    void host_USART_tx(uint8_t c){
+
+        unsigned long long now = tx_late ? tx_at_us : host_time_us;
+
+        if (tx_char_us){
+            if (tx_free_us < now){
+                tx_free_us = now;                                   // the line was idle
+            }
+            tx_free_us += tx_char_us;
+        }
+
+        if (pty_fd >= 0){
+            if (write(pty_fd, &c, 1) != 1){
+                perror("host_USART_tx");
+            }
+        }
+        else if (tx_len < HOST_BUF_LEN){
+            tx_capture[tx_len++] = c;
+        }
+
+        if (loopback){
+            host_USART_inject((const char *) &c, 1);
+        }
+    }
+
+
+
+/**
+ * @brief UDRE and TXC for the UCSRA model.  Unpaced both are always set.  Paced, UDRE is set while
+ * at most one character is in the shift register and TXC once the line is idle.  A read that
+ * finds UDRE clear advances the clock by 1 uS so that a loop waiting for it makes progress.
+ */
+    uint8_t host_USART_tx_flags(void){
+
+        uint8_t flags = tx_flags();
+
+        if (!(flags & (1 << UDRE0))){
+            host_time_us++;
+        }
+        return flags;
+    }
+
+
+
+    static uint8_t tx_flags(void){
+
+        if (!tx_char_us || (tx_free_us <= host_time_us)){
+            return (1 << UDRE0) | (1 << TXC0);
+        }
+        if (tx_free_us - host_time_us <= tx_char_us){
+            return (1 << UDRE0);
+        }
+        return 0;
+    }
+
+
+
+/**
+ * @brief The driver has armed the UDRE interrupt.  Unpaced UDRE is always set in the model so the
+ * ISR runs until the transmit buffer is empty.  Nothing happens if the call comes from within
+ * host_USART_service which drains the buffer itself.  Paced, the ISR runs from host_USART_service
+ * as the line makes room.
+ */
+    void host_USART_UDRIE(void){
+
+        if (in_service){
+            return;
+        }
+        in_service = 1;
+        tx_drain();
+        in_service = 0;
+    }
+
+
+
+/**
+ * @brief Run the UDRE ISR while it is armed and the data register is empty.  Paced, simulated time
+ * may have jumped since the last call, e.g., over a delayMicroseconds.  The line kept sending in
+ * the meantime so each character is written when the one before it made room, not now.
+ */
+    static void tx_drain(void){
+
+        unsigned long long empty_us;
+
+        while (host_USART0_regs.UCSRB & (1 << UDRIE0)){
+            if (tx_char_us){
+                empty_us = (tx_free_us > tx_char_us) ? tx_free_us - tx_char_us : 0;
+                if (empty_us > host_time_us){
+                    break;                                          // the data register is still full
+                }
+                tx_at_us = (empty_us > tx_drained_us) ? empty_us : tx_drained_us;
+                tx_late = 1;
+            }
+            USART_UDRE_vect();
+            tx_late = 0;
+        }
+        tx_drained_us = host_time_us;
+    }
+
+
+
+/**
+ * @brief Play the part of the interrupt controller.  Drain the transmit buffer through the UDRE
+ * ISR and then deliver each pending received character through the RX ISR.  Nothing is delivered
+ * until the receiver and its interrupt have been enabled by USART_init.
+ */
+    void host_USART_service(void){
+
+        uint8_t c;
+
+        if (in_service){
+            return;
+        }
+        in_service = 1;
+
+        timer2_service();                                           // time first - a received char restarts the count
+
+        tx_drain();
+        TX_complete();
+
+        if (attached_device){
+            attached_device();
+        }
+
+        if (pty_fd >= 0){
+            while (read(pty_fd, &c, 1) == 1){
+                host_USART_inject((const char *) &c, 1);
+            }
+        }
+
+        if (rx_enabled()){
+            while ((rx_tail != rx_head) && (host_time_us >= rx_next_us)){
+                if (rx_char_us){                                    // keep time with the line, not with the calls
+                    if (rx_next_us + rx_char_us < host_time_us){
+                        rx_next_us = host_time_us;                  // the line was idle
+                    }
+                    rx_next_us += rx_char_us;
+                }
+                rx_deliver();
+            }
+        }
+
+        in_service = 0;
+    }
+
+
+
+    static uint8_t rx_enabled(void){
+
+        return (host_USART0_regs.UCSRB & ((1 << RXEN0) | (1 << RXCIE0))) == ((1 << RXEN0) | (1 << RXCIE0));
+    }
+
+
+
+/**
+ * @brief Hand the oldest character on the wire to the receive ISR.
+ */
+    static void rx_deliver(void){
+
+        host_USART0_regs.UDR.rx = rx_queue[rx_tail];
+        rx_tail = (rx_tail + 1) % HOST_BUF_LEN;
+        USART_RX_vect();
+    }
+
+
+
+/**
+ * @brief Called by the driver while it waits for the transmitter, e.g., for room in a full
+ * transmit buffer.  One microsecond passes and the interrupts run, as they would on the AVR.
+ */
+    void host_USART_wait(void){
+
+        host_time_us++;
+        host_USART_service();
+    }
+
+
+
+/**
+ * @brief The TXC ISR runs, if the driver has enabled it, on the service after the transmit buffer
+ * was drained and, paced, the line has gone idle.  Running it from host_USART_UDRIE would end the
+ * transmission after every character of a message that is still being queued.
+ */
+    static void TX_complete(void){
+
+        if ((host_USART0_regs.UCSRB & (1 << TXCIE0)) && USART_TX_vect && (tx_flags() & (1 << TXC0))){
+            USART_TX_vect();
+        }
+    }
+
+
+
+/**
+ * @brief Advance Timer2 by the simulated time since the last call.  Only CTC mode with the compare
+ * match A interrupt is modeled.
+ */
+    static void timer2_service(void){
+
+        uint8_t CS = TCCR2B & 0x07;
+        unsigned long long ticks;
+        unsigned long count;
+
+        if (!CS){
+            timer2_last_us = host_time_us;
+            return;
+        }
+
+        ticks = (host_time_us - timer2_last_us) * (F_CPU / 1000000UL) / timer2_prescale[CS];
+        if (!ticks){
+            return;                                                 // less than one count - let the time accumulate
+        }
+        timer2_last_us += ticks * timer2_prescale[CS] / (F_CPU / 1000000UL);
+
+        count = TCNT2 + ticks;
+        if (count > OCR2A){
+            TCNT2 = 0;
+            if ((TIMSK2 & (1 << OCIE2A)) && TIMER2_COMPA_vect){
+                TIMER2_COMPA_vect();
+            }
+        }
+        else{
+            TCNT2 = count;
+        }
+    }
+
+
+
+    void host_USART_loopback(uint8_t on){
+
+        loopback = on;
+    }
+
+
+
+/**
+ * @brief Receive one character every char_us of simulated time as a real line would, instead of
+ * all the pending characters on the next service.  A message longer than the receive buffer
+ * then arrives no faster than the sketch must take it.
+ *
+ * @param char_us the time of one character e.g., 10 bits / baud rate, 0 = no pacing
+ */
+    void host_USART_pace(unsigned long char_us){
+
+        rx_char_us = char_us;
+        rx_next_us = 0;
+    }
+
+
+
+/**
+ * @brief Transmit one character every char_us of simulated time instead of at once.  puts then
+ * waits for the line as it does on the AVR while nb_puts returns once the characters are queued.
+ *
+ * @param char_us the time of one character e.g., 10 bits / baud rate, 0 = instantaneous
+ */
+    void host_USART_pace_tx(unsigned long char_us){
+
+        tx_char_us = char_us;
+        tx_free_us = 0;
+    }
+
+
+
+/**
+ * @brief Attach a model of the far end.  It is called on every service after the transmit buffer
+ * has been drained and before the received characters are delivered.  It normally collects the
+ * transmitted characters with host_USART_take_tx and answers with host_USART_inject.
+ */
+    void host_USART_attach(void (*device)(void)){
+
+        attached_device = device;
+    }
+
+
+
+/**
+ * @brief Connect the USART to a new pseudo-terminal.  The name of the terminal is printed so
+ * that another program can open it.
+ *
+ * @return 0 = success, -1 = failure
+ */
+    int host_USART_open_pty(void){
+
+        pty_fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if ((pty_fd < 0) || grantpt(pty_fd) || unlockpt(pty_fd)){
+            perror("host_USART_open_pty");
+            return -1;
+        }
+        fcntl(pty_fd, F_SETFL, O_NONBLOCK);
+        printf("USART0 connected to %s\n", ptsname(pty_fd));
+        fflush(stdout);
+        return 0;
+    }
+
+
+
+/**
+ * @brief Place N characters on the wire toward the USART.  They are received the next time
+ * host_USART_service runs.
+ *
+ * When the wire already holds HOST_BUF_LEN - 1 characters the oldest is handed to the receive ISR
+ * at once.  The driver then stores it or counts it as dropped, as it would on the AVR.  With the
+ * receiver disabled the oldest character is lost, as it is on the AVR.
+ */
+    void host_USART_inject(const char *D, uint16_t N){
+
+        while (N--){
+            if ((rx_head + 1) % HOST_BUF_LEN == rx_tail){
+                if (rx_enabled())
+                    rx_deliver();
+                else
+                    rx_tail = (rx_tail + 1) % HOST_BUF_LEN;
+            }
+            rx_queue[rx_head] = *D++;
+            rx_head = (rx_head + 1) % HOST_BUF_LEN;
+        }
+    }
+
+
+
+    uint16_t host_USART_rx_pending(void){
+
+        return (rx_head - rx_tail + HOST_BUF_LEN) % HOST_BUF_LEN;
+    }
+
+
+
+/**
+ * @brief Collect the characters transmitted since the last call.
+ *
+ * @return the number of characters placed in D (not null terminated)
+ */
+    uint16_t host_USART_take_tx(char *D, uint16_t max){
+
+        uint16_t n = (tx_len < max) ? tx_len : max;
+
+        for (uint16_t i = 0; i < n; i++){
+            D[i] = tx_capture[i];
+        }
+        for (uint16_t i = n; i < tx_len; i++){
+            tx_capture[i - n] = tx_capture[i];
+        }
+        tx_len -= n;
+        return n;
+    }
@@ -0,0 +1,132 @@
+/**
+ * @file USART_host.h
+ *
+ * @brief Register model of USART0 for Linux builds.  It is used in place of the AVR register
+ * block when USART_HOST is defined (see USART_port.h and the Makefile).  The driver in
+ * USART_port.h runs unchanged on top of it.
+ *
+ * The model has four possible connections:
+ *
+ *      script      the program injects received characters with host_USART_inject and collects
+ *                  the transmitted characters with host_USART_take_tx
+ *      loopback    every transmitted character is also received
+ *      pty         the characters go to a pseudo-terminal e.g., for use with a MODBUS master tool
+ *      device      a function called on every service plays the far end, e.g., a simulated slave
+ *                  that collects the requests and injects its replies when they are due
+ *
+ * Transmission is instantaneous unless host_USART_pace_tx is called.  UDRE and TXC then always
+ * read as set.  The transmit buffer is drained through the UDRE ISR as soon as the driver arms it,
+ * so a loop that only polls USART_is_TX_idle still sees the transmitter finish.  Paced, each
+ * character occupies the line for the time given and UDRE and TXC follow the simulated clock as
+ * they would on the AVR.  The TXC ISR, when enabled, runs from host_USART_service.  The receive
+ * ISR is called for each pending character by host_USART_service.  That function is called by
+ * delay(), delayMicroseconds(), millis(), and micros().  A host main() should also call it between
+ * calls to loop() as that is where interrupts would have occurred on the AVR.
+ */
+
+#ifndef _USART_HOST_H
+
+    #define _USART_HOST_H
+
+    #include <stdint.h>
+    #include <avr/io.h>
+
+    void host_USART_tx(uint8_t c);
+
+
+    struct host_UDR {                                               // a write transmits, a read returns the received char
+
+        uint8_t rx;
+
+        host_UDR &operator=(uint8_t c){
+            host_USART_tx(c);
+            return *this;
+        }
+
+        operator uint8_t() const {
+            return rx;
+        }
+    };
+
+
+    void host_USART_UDRIE(void);
+
+
+    struct host_UCSRB {                                             // setting UDRIE drains the transmit buffer at once
+
+        uint8_t bits;
+
+        host_UCSRB &operator=(uint8_t c){
+            bits = c;
+            return *this;
+        }
+
+        host_UCSRB &operator|=(uint8_t c){
+            bits |= c;
+            if (c & (1 << UDRIE0)){
+                host_USART_UDRIE();
+            }
+            return *this;
+        }
+
+        host_UCSRB &operator&=(uint8_t c){
+            bits &= c;
+            return *this;
+        }
+
+        operator uint8_t() const {
+            return bits;
+        }
+    };
+
+
+    uint8_t host_USART_tx_flags(void);
+
+
+    struct host_UCSRA {                                             // UDRE and TXC from the model, see host_USART_pace_tx
+
+        uint8_t flags;
+
+        host_UCSRA &operator=(uint8_t c){
+            flags = c & ((1 << U2X0) | (1 << MPCM0));
+            return *this;
+        }
+
+        operator uint8_t() const {
+            return flags | host_USART_tx_flags();
+        }
+    };
+
+
+    typedef struct {
+        host_UCSRA UCSRA;
+        host_UCSRB UCSRB;
+        volatile uint8_t UCSRC;
+        volatile uint8_t reserved;
+        volatile uint8_t UBRRL;
+        volatile uint8_t UBRRH;
+        host_UDR UDR;
+    } host_regs_t;
+
+    extern host_regs_t host_USART0_regs;
+
+    struct USART0_hw {
+        typedef host_regs_t regs_t;
+        static inline regs_t &regs(void){ return host_USART0_regs; }
+    };
+
+
+    void host_USART_service(void);
+    void host_USART_wait(void);
+
+    void host_USART_loopback(uint8_t on);
+    int host_USART_open_pty(void);
+    void host_USART_attach(void (*device)(void));
+    void host_USART_pace(unsigned long char_us);
+    void host_USART_pace_tx(unsigned long char_us);
+
+    void host_USART_inject(const char *D, uint16_t N);
+    uint16_t host_USART_rx_pending(void);
+    uint16_t host_USART_take_tx(char *D, uint16_t max);
+
+#endif
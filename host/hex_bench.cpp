@@ -0,0 +1,305 @@
+/**
+ * @file hex_bench.cpp
+ *
+ * @brief Time the MODBUS ASCII hex conversion on the host.  The original per nibble functions
+ * (copied here as old_*) are compared with the table driven functions in ASCII_MODBUS.cpp.
+ *
+ *      encode      build ":020300010004F6" CR LF from 6 bytes
+ *      slave       read the address, function, starting address, and count from a request as the
+ *                  slave_example sketch does
+ *      master      convert the byte count and the 4 words of a read holding registers reply
+ *
+ * The new functions also check every digit and the LRC.  The old ones did not.  The slave and
+ * master cases are therefore also timed against checked, a version of the old functions that
+ * converts the same bytes and makes the same checks.  That is the cost the old code would have
+ * had to pay for the same result.
+ *
+ * The absolute times say little about the AVR.  The ratio between old and new is the result.  On
+ * x86 the table lookups cost more than the old compare and subtract, whose branch is predicted
+ * perfectly for these frames, so the unchecked old decode is faster.  On the AVR the lookup is a
+ * single LPM per digit, with no branch.
+ * The old functions are kept out of line, as they were in the library, and one character of the
+ * input changes on every pass so that the compiler cannot convert the constant frames ahead of
+ * time.
+ */
+
+    #include <stdint.h>
+    #include <stdio.h>
+    #include <string.h>
+    #include <time.h>
+
+    #include <Arduino.h>
+    #include "USART.h"
+    #include "USART_instance.h"                                     // the library needs a USART to link
+
+
+    #define PASSES  10000000UL
+    #define RUNS    5
+
+
+// The functions under test in ASCII_MODBUS.cpp
+
+    void pack_ASCII_str(char *line, uint8_t *c, uint8_t N_char);
+    uint8_t ASCII_hex_2_bytes(uint8_t *D, const char *S, uint8_t N_bytes, uint8_t *LRC);
+
+
+// Private functions
+
+    static double seconds(void);
+    static double best_of(void (*f)(void));
+    static void report(const char *name, const char *base, double t_old, double t_new);
+
+
+// Private variables
+
+    static volatile uint16_t sink;                                  // keeps the compiler from removing the work
+
+    static char request[] = ":020300010004F6\r";
+    static char reply[] = ":0203080001000200030004E9\r";
+    static uint8_t request_bytes[] = { 0x02, 0x03, 0x00, 0x01, 0x00, 0x04 };
+
+
+
+/*******************************************************************************
+ *  The original functions
+ ******************************************************************************/
+
+    static const char old_digit[] = {'0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F'};
+
+    static uint8_t old_ASCII_hex_2_bin(char c){
+
+        if (c <= '9'){
+            return c - '0';
+        }
+        return (c - 'A') + 10;
+    }
+
+    __attribute__((noinline)) static uint16_t old_LRC_gen(uint8_t *data, uint8_t length){
+
+        uint8_t LRC = 0;
+
+        while(length--){
+            LRC += *data++;
+        }
+        return 0 - LRC;
+    }
+
+    __attribute__((noinline)) static void old_byte_array_2_str(char *line, uint8_t length, uint8_t *hex_array){
+
+        while(length--){
+            *line++ = old_digit[*hex_array >> 4];
+            *line++ = old_digit[*hex_array & 0x0F];
+            hex_array++;
+        }
+        *line = 0x00;
+    }
+
+    __attribute__((noinline)) static void old_pack_ASCII_str(char *line, uint8_t *c, uint8_t N_char){
+
+        uint8_t LRC = old_LRC_gen(c, N_char);
+
+        *line++ = ':';
+        old_byte_array_2_str(line, N_char, c);
+        line += N_char << 1;
+        *line++ = old_digit[LRC >> 4];
+        *line++ = old_digit[LRC & 0x0F];
+        *line++ = 0x0D;
+        *line++ = 0x0A;
+        *line++ = 0x00;
+    }
+
+    __attribute__((noinline)) static uint8_t old_get_Nth_int(const USART_line_t *L, uint8_t N){
+
+        uint8_t d_1 = old_ASCII_hex_2_bin(USART_line_char(L, N));
+        uint8_t d_0 = old_ASCII_hex_2_bin(USART_line_char(L, N + 1));
+
+        return (d_1 << 4) + d_0;
+    }
+
+    __attribute__((noinline)) static uint16_t old_get_Nth_word(const USART_line_t *L, uint8_t N){
+
+        uint8_t d_3 = old_ASCII_hex_2_bin(USART_line_char(L, N));
+        uint8_t d_2 = old_ASCII_hex_2_bin(USART_line_char(L, N + 1));
+        uint8_t d_1 = old_ASCII_hex_2_bin(USART_line_char(L, N + 2));
+        uint8_t d_0 = old_ASCII_hex_2_bin(USART_line_char(L, N + 3));
+
+        return (((d_3 << 4) + d_2) << 8) + (d_1 << 4) + d_0;
+    }
+
+
+
+/**
+ * @brief The old conversion extended to make the checks of ASCII_hex_2_bytes: every character
+ * must be an upper case hex digit and the bytes are summed for the LRC.
+ */
+    __attribute__((noinline)) static uint8_t old_checked_2_bytes(uint8_t *D, const char *S, uint8_t N_bytes, uint8_t *LRC){
+
+        uint8_t sum = 0;
+        char c;
+
+        for (uint8_t i = 0; i < 2 * N_bytes; i++){
+            c = S[i];
+            if (!(((c >= '0') && (c <= '9')) || ((c >= 'A') && (c <= 'F')))){
+                return 0;
+            }
+        }
+        while (N_bytes--){
+            *D = (old_ASCII_hex_2_bin(S[0]) << 4) + old_ASCII_hex_2_bin(S[1]);
+            sum += *D++;
+            S += 2;
+        }
+        *LRC = sum;
+        return 1;
+    }
+
+
+
+    static char line[64];
+    static uint8_t frame[32];
+    static uint8_t LRC;
+    static USART_line_t L = { request, (uint8_t) (sizeof(request) - 1), request, 0 };
+
+
+
+/*******************************************************************************
+ *  The cases.  Each runs PASSES times.
+ ******************************************************************************/
+
+    static void encode_old(void){
+
+        for (unsigned long i = 0; i < PASSES; i++){
+            request_bytes[5] = i;
+            old_pack_ASCII_str(line, request_bytes, 6);
+            sink += line[13];
+        }
+    }
+
+    static void encode_new(void){
+
+        for (unsigned long i = 0; i < PASSES; i++){
+            request_bytes[5] = i;
+            pack_ASCII_str(line, request_bytes, 6);
+            sink += line[13];
+        }
+    }
+
+    static void slave_old(void){                                    // four fields from the request
+
+        for (unsigned long i = 0; i < PASSES; i++){
+            request[12] = old_digit[i & 0x0F];
+            sink += old_get_Nth_int(&L, 1) + old_get_Nth_int(&L, 3) + old_get_Nth_word(&L, 5) + old_get_Nth_word(&L, 9);
+        }
+    }
+
+    static void slave_new(void){
+
+        for (unsigned long i = 0; i < PASSES; i++){
+            request[12] = old_digit[i & 0x0F];
+            sink += ASCII_hex_2_bytes(frame, L.seg_1 + 1, (L.len_1 - 2) >> 1, &LRC) + LRC;
+            sink += frame[0] + frame[1] + ((frame[2] << 8) + frame[3]) + ((frame[4] << 8) + frame[5]);
+        }
+    }
+
+    static void slave_checked(void){
+
+        for (unsigned long i = 0; i < PASSES; i++){
+            request[12] = old_digit[i & 0x0F];
+            sink += old_checked_2_bytes(frame, L.seg_1 + 1, (L.len_1 - 2) >> 1, &LRC) + LRC;
+            sink += frame[0] + frame[1] + ((frame[2] << 8) + frame[3]) + ((frame[4] << 8) + frame[5]);
+        }
+    }
+
+    static void master_old(void){                                   // the byte count and four words from the reply
+
+        for (unsigned long i = 0; i < PASSES; i++){
+            reply[10] = old_digit[i & 0x0F];
+            sink += (old_ASCII_hex_2_bin(reply[5]) << 4) + old_ASCII_hex_2_bin(reply[6]);
+            for (uint16_t j = 0; j < 16; j = j + 4){
+                uint16_t temp;
+
+                temp =  old_ASCII_hex_2_bin(reply[j + 7]) << 12;
+                temp += old_ASCII_hex_2_bin(reply[j + 8]) << 8;
+                temp += old_ASCII_hex_2_bin(reply[j + 9]) << 4;
+                temp += old_ASCII_hex_2_bin(reply[j + 10]);
+                sink += temp;
+            }
+        }
+    }
+
+    static void master_new(void){
+
+        for (unsigned long i = 0; i < PASSES; i++){
+            reply[10] = old_digit[i & 0x0F];
+            sink += ASCII_hex_2_bytes(frame, reply + 1, (sizeof(reply) - 3) >> 1, &LRC) + LRC;
+            sink += frame[2];
+            for (uint8_t j = 3; j < 11; j = j + 2){
+                sink += (frame[j] << 8) + frame[j + 1];
+            }
+        }
+    }
+
+
+
+    static void master_checked(void){
+
+        for (unsigned long i = 0; i < PASSES; i++){
+            reply[10] = old_digit[i & 0x0F];
+            sink += old_checked_2_bytes(frame, reply + 1, (sizeof(reply) - 3) >> 1, &LRC) + LRC;
+            sink += frame[2];
+            for (uint8_t j = 3; j < 11; j = j + 2){
+                sink += (frame[j] << 8) + frame[j + 1];
+            }
+        }
+    }
+
+
+
+int main(void){
+
+    report("encode", "old", best_of(encode_old), best_of(encode_new));
+    report("slave", "old", best_of(slave_old), best_of(slave_new));
+    report("master", "old", best_of(master_old), best_of(master_new));
+    report("slave", "checked", best_of(slave_checked), best_of(slave_new));
+    report("master", "checked", best_of(master_checked), best_of(master_new));
+
+    return 0;
+}
+
+
+
+/**
+ * @brief The shortest of RUNS timings filters out interruptions by the operating system.
+ */
+    static double best_of(void (*f)(void)){
+
+        double best = 1e9;
+        double t;
+
+        for (uint8_t run = 0; run < RUNS; run++){
+            t = seconds();
+            f();
+            t = seconds() - t;
+            if (t < best){
+                best = t;
+            }
+        }
+        return best;
+    }
+
+
+
+    static void report(const char *name, const char *base, double t_old, double t_new){
+
+        printf("%-8s %-7s %6.1f nS per frame   new %6.1f nS per frame   %.2fx\n",
+               name, base, 1e9 * t_old / PASSES, 1e9 * t_new / PASSES, t_old / t_new);
+    }
+
+
+
+    static double seconds(void){
+
+        struct timespec t;
+
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + t.tv_nsec * 1e-9;
+    }
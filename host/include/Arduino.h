@@ -0,0 +1,47 @@
+/**
+ * @file Arduino.h
+ *
+ * @brief Host replacement for the parts of the Arduino core used by the sketchbook.  Time is
+ * simulated.  delay() and delayMicroseconds() advance the clock and let the hardware models run.
+ * See Arduino_host.cpp.
+ */
+
+#ifndef _HOST_ARDUINO_H
+
+    #define _HOST_ARDUINO_H
+
+    #include <stdint.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <avr/io.h>
+    #include <avr/interrupt.h>
+    #include <avr/pgmspace.h>
+
+    #define LOW     0x0
+    #define HIGH    0x1
+    #define INPUT   0x0
+    #define OUTPUT  0x1
+
+    #define A0      14
+    #define A1      15
+    #define A2      16
+    #define A3      17
+    #define A4      18
+    #define A5      19
+
+    #define F_CPU   16000000UL
+
+    void pinMode(uint8_t pin, uint8_t mode);
+    void digitalWrite(uint8_t pin, uint8_t val);
+    int digitalRead(uint8_t pin);
+
+    unsigned long millis(void);
+    unsigned long micros(void);
+    void delay(unsigned long ms);
+    void delayMicroseconds(unsigned int us);
+
+    void setup(void);
+    void loop(void);
+
+#endif
@@ -0,0 +1,24 @@
+/**
+ * @file interrupt.h
+ *
+ * @brief Host replacement for <avr/interrupt.h>.  An ISR is an ordinary function.  The hardware
+ * models (see USART_host.cpp) call it between loop() iterations and from delay().  Nothing runs
+ * concurrently with the sketch so cli() and sei() only maintain the I bit in SREG.
+ */
+
+#ifndef _HOST_AVR_INTERRUPT_H
+
+    #define _HOST_AVR_INTERRUPT_H
+    #include <avr/io.h>
+
+    #define ISR(vector) extern "C" void vector(void); extern "C" void vector(void)
+
+    #define cli()               (SREG &= (uint8_t) ~0x80)
+    #define sei()               (SREG |= 0x80)
+
+    #define USART_RX_vect       host_USART_RX_vect
+    #define USART_UDRE_vect     host_USART_UDRE_vect
+    #define USART_TX_vect       host_USART_TX_vect
+    #define TIMER2_COMPA_vect   host_TIMER2_COMPA_vect
+
+#endif
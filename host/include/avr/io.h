@@ -0,0 +1,83 @@
+/**
+ * @file io.h
+ *
+ * @brief Host replacement for <avr/io.h>.  The I/O registers of the ATmega328p are ordinary memory
+ * in host_io[].  Only the registers and bits used by the sketchbook libraries are defined.
+ *
+ * The USART0 registers are not here.  USART_port uses the register model in USART_host.h instead.
+ */
+
+#ifndef _HOST_AVR_IO_H
+
+    #define _HOST_AVR_IO_H
+    #include <stdint.h>
+
+    extern volatile uint8_t host_io[0x200];
+
+    #define _HOST_IO(addr)  (host_io[(addr)])
+    #define _HOST_IO16(addr) (*(volatile uint16_t *) &host_io[(addr)])
+
+// Status register
+
+    #define SREG            _HOST_IO(0x5F)
+
+// USART0 bits (the bit positions are the same for every USART)
+
+    #define RXC0            7
+    #define TXC0            6
+    #define UDRE0           5
+    #define FE0             4
+    #define DOR0            3
+    #define UPE0            2
+    #define U2X0            1
+    #define MPCM0           0
+
+    #define RXCIE0          7
+    #define TXCIE0          6
+    #define UDRIE0          5
+    #define RXEN0           4
+    #define TXEN0           3
+    #define UCSZ02          2
+
+    #define UPM01           5
+    #define UPM00           4
+    #define USBS0           3
+    #define UCSZ01          2
+    #define UCSZ00          1
+
+// Timer1
+
+    #define TCCR1A          _HOST_IO(0x80)
+    #define TCCR1B          _HOST_IO(0x81)
+    #define TCNT1           _HOST_IO16(0x84)
+    #define CS10            0
+
+// Timer2
+
+    #define TIFR2           _HOST_IO(0x37)
+    #define TIMSK2          _HOST_IO(0x70)
+    #define TCCR2A          _HOST_IO(0xB0)
+    #define TCCR2B          _HOST_IO(0xB1)
+    #define TCNT2           _HOST_IO(0xB2)
+    #define OCR2A           _HOST_IO(0xB3)
+    #define OCF2A           1
+    #define OCIE2A          1
+    #define WGM21           1
+    #define CS22            2
+    #define CS21            1
+    #define CS20            0
+
+// ADC
+
+    #define ADC             _HOST_IO16(0x78)
+    #define ADCSRA          _HOST_IO(0x7A)
+    #define ADMUX           _HOST_IO(0x7C)
+    #define ADEN            7
+    #define ADSC            6
+    #define ADPS2           2
+    #define ADPS1           1
+    #define ADPS0           0
+    #define REFS1           7
+    #define REFS0           6
+
+#endif
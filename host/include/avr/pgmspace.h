@@ -0,0 +1,16 @@
+/**
+ * @file pgmspace.h
+ *
+ * @brief Host replacement for <avr/pgmspace.h>.  There is only one address space.
+ */
+
+#ifndef _HOST_AVR_PGMSPACE_H
+
+    #define _HOST_AVR_PGMSPACE_H
+    #include <stdint.h>
+
+    #define PROGMEM
+    #define pgm_read_byte(addr)     (*(const uint8_t *)(addr))
+    #define pgm_read_word(addr)     (*(const uint16_t *)(addr))
+
+#endif
@@ -0,0 +1,444 @@
+/**
+ * @file master_bench.cpp
+ *
+ * @brief Count the main loop iterations per second of a MODBUS master that polls a slave without
+ * a break.  The same loop is run for RUN_SECONDS of simulated time in each of four ways:
+ *
+ *      blocking    MODBUS_read_registers, the loop stops until the reply arrives
+ *      polled      MODBUS_submit_read and MODBUS_poll, the loop keeps running
+ *      scheduled   MODBUS_sched_service reads slave 1 every 50 mS and slave 3 every 100 mS, and
+ *                  reads slave 2 with the time left over
+ *      shared      as scheduled, but the three reads have the same priority.  The read of slave 2
+ *                  has no deadline so it still only gets the time left over.
+ *      125 words   as polled, but each read is of MODBUS_MAX_READ_WORDS.  The reply is four times
+ *                  the size of the USART receive buffer.
+ *
+ * Each iteration also does WORK_US of other work (standing in for the ADC and the LCD).
+ *
+ * The slaves are simulated by a device attached to the USART model.  It answers each read holding
+ * registers request for addresses 1 through N_SLAVES once the request has crossed the wire at
+ * BAUD and the slave has taken SLAVE_RESPONSE_US to start (about 2.5 mS for the GS1).  The reply
+ * is received one character every CHAR_US.  The times are simulated so the result does not depend
+ * on the speed of the host.
+ *
+ * Then the N_SLAVES drives are started with GS1_turn_on, one after another, and then all at once
+ * with GS1_all_turn_on.  The time each drive receives its command is recorded.  The skew is from
+ * the first drive to start to the last.
+ *
+ * Then the speed of a drive is ramped through RAMP_STEPS values RAMP_MS apart, as the
+ * GS1_Arduino_interface sketch does.  Directly, each GS1_set_speed waits for its echo.  Through the
+ * register cache (see MODBUS_cache_write), the bus sends the latest speed whenever it is free.
+ *
+ * Last, three GS1 parameters (mtr_name_volts, mtr_base_rpm, and acceleration_time_1) are read
+ * PARAM_QUERIES times.  Directly, each is a read of the bus.  Through the register cache (see
+ * GS1_get_parameter), each group is read once.
+ *
+ * After the scheduled run the reply times kept by the master are printed (see MODBUS_get_latency).
+ * The model sends the request the moment it is queued, so its time on the wire appears in the
+ * response time.  The timeout column is what MODBUS_set_adaptive_timeout(5, 100) would give each
+ * slave.
+ */
+
+    #include <stdint.h>
+    #include <stdio.h>
+    #include <string.h>
+
+    #include <Arduino.h>
+    #include "USART.h"
+    #include "USART_instance.h"
+    #include "ASCII_MODBUS.h"
+    #include "MODBUS_scheduler.h"
+    #include "GS1_support.h"
+    #include "MODBUS_cache.h"
+    #include "GS1_cache.h"
+    #include "error.h"
+
+
+    #define BAUD                19200UL
+    #define CHAR_US             (10 * 1000000UL / BAUD)         // start, 8 data, and stop bits
+    #define SLAVE_RESPONSE_US   2500
+    #define WORK_US             100
+    #define RUN_SECONDS         10
+
+    #define DIR_PIN             2
+    #define SLAVE_ADDR          2
+    #define N_SLAVES            3
+    #define N_WORDS             4
+    #define RAMP_STEPS          550
+    #define RAMP_MS             5
+    #define PARAM_QUERIES       100
+
+    extern unsigned long long host_time_us;
+
+
+// The function in ASCII_MODBUS.cpp used to build the replies
+
+    void pack_ASCII_str(char *line, uint8_t *c, uint8_t N_char);
+
+
+// Private functions
+
+    static void slave_device(void);
+    static void blocking_loop(void);
+    static void polled_loop(void);
+    static void scheduled_loop(void);
+    static void large_loop(void);
+    static void run(const char *name, void (*loop)(void));
+    static void print_latency(void);
+    static void start_drives(const char *name, uint8_t broadcast);
+    static void ramp(const char *name, uint8_t cached);
+    static void parameters(const char *name, uint8_t cached);
+
+
+// Private variables
+
+    static char request[64];
+    static uint8_t request_len = 0;
+    static char reply[12 + 4 * MODBUS_MAX_READ_WORDS];             // ":", 4 + 2N bytes in hex, CR, LF, and the null
+    static uint8_t reply_pending = 0;
+    static unsigned long long reply_due;
+
+    static uint16_t words[N_WORDS];
+    static uint16_t status_1[2];
+    static uint16_t status_3[2];
+    static uint16_t block[MODBUS_MAX_READ_WORDS];
+    static unsigned long reads;
+    static unsigned long failures;
+    static unsigned long long started[N_SLAVES + 1];               // when each drive received its run command, 0 = not yet
+    static uint16_t speed;                                          // the speed reference of SLAVE_ADDR
+    static unsigned long speed_writes;
+
+
+
+int main(void){
+
+    MODBUS_init(DIR_PIN, 100);
+    host_USART_attach(slave_device);
+    host_USART_pace(CHAR_US);
+
+    run("blocking", blocking_loop);
+    run("polled", polled_loop);
+
+    MODBUS_sched_poll(status_1, 1, 0x2100, 2, 50, 0);
+    MODBUS_sched_poll(status_3, 3, 0x2100, 2, 100, 1);
+    MODBUS_sched_poll(words, SLAVE_ADDR, 0x2100, N_WORDS, 0, 5);
+    run("scheduled", scheduled_loop);
+    print_latency();
+
+    MODBUS_sched_init();
+    while (MODBUS_poll() == MODBUS_BUSY){                           // let the last scheduled read finish
+        host_USART_service();
+    }
+    MODBUS_sched_poll(status_1, 1, 0x2100, 2, 50, 0);
+    MODBUS_sched_poll(status_3, 3, 0x2100, 2, 100, 0);
+    MODBUS_sched_poll(words, SLAVE_ADDR, 0x2100, N_WORDS, 0, 0);
+    run("shared", scheduled_loop);
+
+    MODBUS_sched_init();
+    while (MODBUS_poll() == MODBUS_BUSY){
+        host_USART_service();
+    }
+    run("125 words", large_loop);
+    while (MODBUS_poll() == MODBUS_BUSY){
+        host_USART_service();
+    }
+
+    start_drives("one by one", 0);
+    start_drives("broadcast", 1);
+
+    ramp("ramp direct", 0);
+    ramp("ramp cached", 1);
+
+    parameters("param direct", 0);
+    parameters("param cached", 1);
+
+    return 0;
+}
+
+
+
+    static void blocking_loop(void){
+
+        if (MODBUS_read_registers(words, SLAVE_ADDR, 0x2100, N_WORDS)){
+            reads++;
+        }
+        else{
+            failures++;
+        }
+        delayMicroseconds(WORK_US);
+    }
+
+
+
+    static void polled_loop(void){
+
+        switch (MODBUS_poll()){
+
+            case MODBUS_IDLE:
+                MODBUS_submit_read(words, SLAVE_ADDR, 0x2100, N_WORDS);
+                break;
+
+            case MODBUS_DONE:
+                reads++;
+                break;
+
+            case MODBUS_FAILED:
+                failures++;
+                break;
+        }
+        delayMicroseconds(WORK_US);
+    }
+
+
+
+    static void scheduled_loop(void){
+
+        MODBUS_sched_stats_t S;
+
+        MODBUS_sched_service();
+        MODBUS_sched_get_stats(MODBUS_SCHED_TOTAL, &S);
+        reads = S.done;
+        failures = S.failed;
+        delayMicroseconds(WORK_US);
+    }
+
+
+
+    static void large_loop(void){
+
+        switch (MODBUS_poll()){
+
+            case MODBUS_IDLE:
+                MODBUS_submit_read(block, SLAVE_ADDR, 0x0000, MODBUS_MAX_READ_WORDS);
+                break;
+
+            case MODBUS_DONE:
+                if ((block[0] == 1) && (block[MODBUS_MAX_READ_WORDS - 1] == MODBUS_MAX_READ_WORDS))
+                    reads++;
+                else
+                    failures++;
+                memset(block, 0, sizeof(block));
+                break;
+
+            case MODBUS_FAILED:
+                failures++;
+                break;
+        }
+        delayMicroseconds(WORK_US);
+    }
+
+
+
+    static void run(const char *name, void (*loop)(void)){
+
+        unsigned long long end = host_time_us + RUN_SECONDS * 1000000ULL;
+        unsigned long iterations = 0;
+
+        reads = 0;
+        failures = 0;
+        while (host_time_us < end){
+            loop();
+            host_USART_service();
+            iterations++;
+        }
+
+        printf("%-9s %8lu loops/s   %5.1f reads/s   %lu failed\n",
+               name, iterations / RUN_SECONDS, (double) reads / RUN_SECONDS, failures);
+
+        if (loop == scheduled_loop){
+            MODBUS_sched_stats_t S;
+
+            for (int8_t job = 0; job < 3; job++){
+                MODBUS_sched_get_stats(job, &S);
+                printf("    job %d  %5u done   %u failed   %u deadlines missed\n", job, S.done, S.failed, S.missed);
+            }
+        }
+    }
+
+
+
+/**
+ * @brief The mean time of each part of a transaction and the histogram of the reply times, all
+ * runs together.
+ */
+    static void print_latency(void){
+
+        MODBUS_latency_t L;
+
+        MODBUS_set_adaptive_timeout(5, 100);
+
+        printf("    slave  replies   send   response  reply   min    max  (uS)   timeout (mS)   histogram < 0.5, 1, 2 ... 32, more mS\n");
+        for (uint8_t slave = 1; slave <= N_SLAVES; slave++){
+            if (!MODBUS_get_latency(slave, &L) || !L.count){
+                continue;
+            }
+            printf("    %5u  %7u  %5lu  %8lu  %5lu  %5lu  %5lu       %3u           ", slave, L.count,
+                   (unsigned long) (L.send_sum_us / L.count), (unsigned long) (L.response_sum_us / L.count),
+                   (unsigned long) (L.reply_sum_us / L.count), (unsigned long) L.min_us, (unsigned long) L.max_us,
+                   MODBUS_get_timeout(slave));
+            for (uint8_t i = 0; i < MODBUS_LATENCY_BUCKETS; i++){
+                printf(" %u", L.histogram[i]);
+            }
+            printf("\n");
+        }
+    }
+
+
+
+    static void start_drives(const char *name, uint8_t broadcast){
+
+        unsigned long long t = host_time_us;
+        unsigned long long first = ~0ULL;
+        unsigned long long last = 0;
+        uint8_t result = 0x01;
+
+        memset(started, 0, sizeof(started));
+        if (broadcast){
+            result = GS1_all_turn_on();
+        }
+        else{
+            for (uint8_t slave = 1; slave <= N_SLAVES; slave++){
+                result &= GS1_turn_on(slave);
+            }
+        }
+        t = host_time_us - t;
+
+        for (uint8_t slave = 1; slave <= N_SLAVES; slave++){
+            if (started[slave] < first)
+                first = started[slave];
+            if (started[slave] > last)
+                last = started[slave];
+        }
+        printf("%-10s %u drives started in %5.1f mS, skew %5.1f mS%s\n", name, N_SLAVES, t / 1000.0,
+               (last - first) / 1000.0, (result && first) ? "" : "   failed");
+    }
+
+
+
+    static void ramp(const char *name, uint8_t cached){
+
+        unsigned long long t = host_time_us;
+        unsigned long start;
+        uint8_t result = 0x01;
+
+        MODBUS_cache_init();
+        speed_writes = 0;
+        for (uint16_t i = 0; i < RAMP_STEPS; i++){
+            if (cached){
+                MODBUS_cache_write(SLAVE_ADDR, Serial_Comm_Speed_Reference, 50 + i);
+                start = millis();
+                while (millis() - start < RAMP_MS){
+                    MODBUS_cache_service();
+                }
+            }
+            else{
+                result &= GS1_set_speed(SLAVE_ADDR, 50 + i);
+                delay(RAMP_MS);
+            }
+        }
+        if (cached){
+            result = MODBUS_cache_flush();
+        }
+        t = host_time_us - t;
+
+        printf("%-11s %u steps in %5.2f S, %4lu writes, final speed %u%s\n", name, RAMP_STEPS, t / 1e6,
+               speed_writes, speed, result ? "" : "   failed");
+    }
+
+
+
+    static void parameters(const char *name, uint8_t cached){
+
+        static const uint16_t param[] = { mtr_name_volts, mtr_base_rpm, acceleration_time_1 };
+        unsigned long long t = host_time_us;
+        uint16_t value;
+        uint8_t result = 0x01;
+        MODBUS_cache_stats_t S;
+
+        MODBUS_cache_init();
+        if (cached){
+            GS1_cache_parameters(SLAVE_ADDR, MODBUS_CACHE_FOREVER);
+        }
+        for (uint16_t i = 0; i < PARAM_QUERIES; i++){
+            for (uint8_t p = 0; p < sizeof(param) / sizeof(param[0]); p++){
+                if (cached)
+                    result &= GS1_get_parameter(SLAVE_ADDR, param[p], &value);
+                else
+                    result &= MODBUS_read_registers(&value, SLAVE_ADDR, param[p], 1);
+            }
+        }
+        t = host_time_us - t;
+
+        MODBUS_cache_get_stats(&S);
+        printf("%-12s %u queries in %5.2f S, %4u reads%s\n", name, PARAM_QUERIES, t / 1e6,
+               cached ? S.reads : PARAM_QUERIES * (unsigned) (sizeof(param) / sizeof(param[0])), result ? "" : "   failed");
+    }
+
+
+
+/**
+ * @brief The simulated slave.  A request is complete when its LF arrives.  The reply holds the
+ * count followed by the words 1, 2, 3, ...  A write of a single register is echoed unless it was
+ * broadcast.  Each drive a run command was addressed to records when it started.
+ */
+    static void slave_device(void){
+
+        char c;
+        unsigned int addr, function, start, n;
+        unsigned long long heard;
+        uint8_t frame[3 + 2 * MODBUS_MAX_READ_WORDS];
+
+        if (reply_pending){
+            if (host_time_us >= reply_due){
+                host_USART_inject(reply, strlen(reply));
+                reply_pending = 0;
+            }
+            return;
+        }
+
+        while (host_USART_take_tx(&c, 1)){
+            if (request_len < sizeof(request) - 1){
+                request[request_len++] = c;
+            }
+            if (c != '\n'){
+                continue;
+            }
+            request[request_len] = 0x00;
+            heard = host_time_us + request_len * CHAR_US;           // the model takes the request as it is queued
+
+            if ((sscanf(request, ":%2x%2x%4x%4x", &addr, &function, &start, &n) == 4) &&
+                (addr <= N_SLAVES) && (function == PRESET_SINGLE_REGISTER)){
+
+                for (uint8_t slave = 1; slave <= N_SLAVES; slave++){
+                    if ((start == Serial_Comm_RUN_Command) && ((addr == slave) || (addr == MODBUS_BROADCAST_ADDR))){
+                        started[slave] = heard;
+                    }
+                }
+                if ((start == Serial_Comm_Speed_Reference) && (addr == SLAVE_ADDR)){
+                    speed = n;
+                    speed_writes++;
+                }
+                if (addr != MODBUS_BROADCAST_ADDR){
+                    strcpy(reply, request);
+                    reply_due = heard + SLAVE_RESPONSE_US;
+                    reply_pending = 1;
+                }
+            }
+
+            if ((sscanf(request, ":%2x%2x%4x%4x", &addr, &function, &start, &n) == 4) &&
+                (addr >= 1) && (addr <= N_SLAVES) && (function == 0x03) && (n <= MODBUS_MAX_READ_WORDS)){
+
+                frame[0] = addr;
+                frame[1] = function;
+                frame[2] = 2 * n;
+                for (uint8_t i = 0; i < n; i++){
+                    frame[3 + 2 * i] = (i + 1) >> 8;
+                    frame[4 + 2 * i] = i + 1;
+                }
+                pack_ASCII_str(reply, frame, 3 + 2 * n);
+                reply_due = heard + SLAVE_RESPONSE_US;
+                reply_pending = 1;
+            }
+            request_len = 0;
+        }
+    }
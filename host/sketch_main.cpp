@@ -0,0 +1,212 @@
+/**
+ * @file sketch_main.cpp
+ *
+ * @brief main() for running an Arduino sketch on a Linux host.  The sketch's setup() is called
+ * once and then loop() is called repeatedly.  The USART is connected to scripted traffic, a
+ * loopback, or a pseudo-terminal.
+ *
+ *      sketch script.txt [-n repeat]   inject each line of the script (CR LF is appended), print
+ *                                      what the sketch transmits in reply, and time the run
+ *      sketch script.txt -r            as above but each line holds an RTU frame as hex bytes
+ *                                      e.g., "02 03 00 00 00 01 84 39".  The reply is printed in hex.
+ *      sketch -p                       connect the USART to a pseudo-terminal and run forever
+ *      sketch -l                       connect the USART transmitter to its receiver and run forever
+ *
+ * Lines in the script starting with '#' and blank lines are ignored.  With -n the script is run
+ * repeatedly and only the first pass is printed.  The throughput is then reported.
+ *
+ * Simulated time advances 1 mS for each idle pass of loop().  This lets the line go quiet between
+ * requests so that the RTU frame timer can end each frame.
+ */
+
+    #include <stdint.h>
+    #include <stdio.h>
+    #include <stdlib.h>
+    #include <string.h>
+    #include <time.h>
+
+    #include <Arduino.h>
+    #include "USART_host.h"
+
+
+    #define MAX_SCRIPT_LINES    256
+    #define MAX_LINE            256
+    #define IDLE_LOOPS          16                              // loop() calls after the request is consumed
+
+
+// Private variables
+
+    static char script[MAX_SCRIPT_LINES][MAX_LINE];
+    static uint16_t script_lines = 0;
+    static uint8_t rtu = 0;
+
+
+// Private functions
+
+    static int read_script(const char *name);
+    static uint16_t run_request(const char *request, char *reply, uint16_t max);
+    static uint16_t hex_2_bytes(const char *line, char *D);
+    static void print_hex(const char *D, uint16_t N);
+    static double seconds(void);
+
+
+
+int main(int argc, char *argv[]){
+
+    char reply[MAX_LINE * 4];
+    unsigned long repeat = 1;
+    unsigned long transactions = 0;
+    const char *script_name = NULL;
+    double start;
+    double elapsed;
+
+    for (int i = 1; i < argc; i++){
+        if (!strcmp(argv[i], "-n") && (i + 1 < argc)){
+            repeat = strtoul(argv[++i], NULL, 0);
+        }
+        else if (!strcmp(argv[i], "-p")){
+            if (host_USART_open_pty()){
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "-l")){
+            host_USART_loopback(1);
+        }
+        else if (!strcmp(argv[i], "-r")){
+            rtu = 1;
+        }
+        else{
+            script_name = argv[i];
+        }
+    }
+
+    setup();
+
+    if (script_name == NULL){
+        while (1){
+            host_USART_service();
+            loop();
+        }
+    }
+
+    if (read_script(script_name)){
+        return 1;
+    }
+
+    start = seconds();
+    for (unsigned long pass = 0; pass < repeat; pass++){
+        for (uint16_t i = 0; i < script_lines; i++){
+            uint16_t n = run_request(script[i], reply, sizeof(reply) - 1);
+            if ((pass == 0) && rtu){
+                printf("> %s\n< ", script[i]);
+                print_hex(reply, n);
+            }
+            else if (pass == 0){
+                reply[n] = 0x00;
+                printf("> %s\n< %s", script[i], n ? reply : "(no reply)\n");
+            }
+            transactions++;
+        }
+    }
+    elapsed = seconds() - start;
+
+    if (repeat > 1){
+        printf("\n%lu requests in %.3f s: %.0f requests per second, %.2f uS per request\n",
+               transactions, elapsed, transactions / elapsed, 1e6 * elapsed / transactions);
+    }
+    return 0;
+}
+
+
+
+/**
+ * @brief Inject one request, run the sketch until the request has been consumed and the sketch
+ * has had IDLE_LOOPS more passes to reply, and then collect the reply.
+ */
+    static uint16_t run_request(const char *request, char *reply, uint16_t max){
+
+        char frame[MAX_LINE];
+
+        if (rtu){
+            host_USART_inject(frame, hex_2_bytes(request, frame));
+        }
+        else{
+            host_USART_inject(request, strlen(request));
+            host_USART_inject("\r\n", 2);
+        }
+
+        while (host_USART_rx_pending()){
+            host_USART_service();
+            loop();
+        }
+        for (uint8_t i = 0; i < IDLE_LOOPS; i++){
+            delay(1);
+            loop();
+        }
+        return host_USART_take_tx(reply, max);
+    }
+
+
+
+/**
+ * @brief Convert a line of hex byte pairs, optionally separated by spaces, to bytes.
+ *
+ * @return the number of bytes placed in D
+ */
+    static uint16_t hex_2_bytes(const char *line, char *D){
+
+        uint16_t n = 0;
+        unsigned int b;
+        int used;
+
+        while (sscanf(line, " %2x%n", &b, &used) == 1){
+            D[n++] = (char) b;
+            line += used;
+        }
+        return n;
+    }
+
+
+
+    static void print_hex(const char *D, uint16_t N){
+
+        if (!N){
+            printf("(no reply)\n");
+            return;
+        }
+        for (uint16_t i = 0; i < N; i++){
+            printf("%02X%c", (uint8_t) D[i], (i + 1 < N) ? ' ' : '\n');
+        }
+    }
+
+
+
+    static int read_script(const char *name){
+
+        FILE *f = fopen(name, "r");
+        char line[MAX_LINE];
+
+        if (f == NULL){
+            perror(name);
+            return -1;
+        }
+        while (fgets(line, sizeof(line), f) && (script_lines < MAX_SCRIPT_LINES)){
+            line[strcspn(line, "\r\n")] = 0x00;
+            if ((line[0] == 0x00) || (line[0] == '#')){
+                continue;
+            }
+            strcpy(script[script_lines++], line);
+        }
+        fclose(f);
+        return 0;
+    }
+
+
+
+    static double seconds(void){
+
+        struct timespec t;
+
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return t.tv_sec + t.tv_nsec * 1e-9;
+    }
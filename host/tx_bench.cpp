@@ -0,0 +1,106 @@
+/**
+ * @file tx_bench.cpp
+ *
+ * @brief Measure on the host how much main loop time the interrupt driven transmit queue frees.
+ * The USART model is paced at 19200 baud so that a character occupies the line for 521 uS of
+ * simulated time, as it would on the AVR.  A 17 character MODBUS frame is sent at the start of
+ * each 20 mS period, first with the blocking USART_puts and then with USART_nb_puts.  For the rest
+ * of the period the main loop does work in steps of LOOP_US.
+ *
+ *      held        simulated time spent in the call that sends the frame
+ *      passes      main loop steps completed in the period
+ *      sent        characters that left the USART in the period
+ *
+ * Copying into the transmit buffer takes no simulated time on the host.  On the AVR nb_puts holds
+ * the loop for some tens of microseconds, see library_tests/USART_benchmark.
+ */
+
+    #include <stdint.h>
+    #include <stdio.h>
+
+    #include <Arduino.h>
+    #include "USART.h"
+    #include "USART_instance.h"
+    #include "USART_host.h"
+
+
+    #define BAUD_RATE   19200UL
+    #define CHAR_US     (10 * 1000000UL / BAUD_RATE)                // start, 8 data, and stop bits
+    #define PERIOD_US   20000UL
+    #define LOOP_US     10                                          // one step of main loop work
+    #define TRIALS      100
+
+
+    extern unsigned long long host_time_us;
+
+
+// Private functions
+
+    static void run(const char *name, void (*send)(char *D));
+    static void send_blocking(char *D);
+    static void send_non_blocking(char *D);
+
+
+// Private variables
+
+    static char frame[] = ":0106091A00A03C\r\n";                    // 17 characters on the wire
+
+
+
+int main(void){
+
+    USART_init(16000000UL, BAUD_RATE);
+    host_USART_pace_tx(CHAR_US);
+
+    run("USART_puts", send_blocking);
+    run("USART_nb_puts", send_non_blocking);
+
+    return 0;
+}
+
+
+
+/**
+ * @brief Send the frame at the start of each period and count the main loop steps that still fit.
+ */
+    static void run(const char *name, void (*send)(char *D)){
+
+        unsigned long long held = 0;
+        unsigned long passes = 0;
+        unsigned long sent = 0;
+        unsigned long long start;
+        unsigned long long end;
+        char tx[64];
+
+        for (uint16_t i = 0; i < TRIALS; i++){
+
+            start = host_time_us;
+            end = start + PERIOD_US;
+
+            send(frame);
+            held += host_time_us - start;
+
+            while (host_time_us < end){
+                delayMicroseconds(LOOP_US);
+                passes++;
+            }
+            sent += host_USART_take_tx(tx, sizeof(tx));
+        }
+
+        printf("%-14s held %5.0f uS per frame   %5lu passes per %lu mS   %2lu characters sent\n",
+               name, (double) held / TRIALS, passes / TRIALS, PERIOD_US / 1000, sent / TRIALS);
+    }
+
+
+
+    static void send_blocking(char *D){
+
+        USART_puts(D);
+    }
+
+
+
+    static void send_non_blocking(char *D){
+
+        USART_nb_puts(D);
+    }
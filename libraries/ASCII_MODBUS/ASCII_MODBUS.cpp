@@ -16,6 +16,27 @@
  *    | LRC       |      2        | Checksum
  *    | End       |      2        | Carriage return – line feed (CR/LF) pair (ASCII values of 0x0D & 0x0A)
  *
+ * The same functions also speak MODBUS RTU when the bus is initialized with MODBUS_init_RTU.  The
+ * bytes are then sent as they are.  The frame is half the length of the ASCII frame plus 3.
+ *
+ *    --------------------------------------------------------------------------
+ *    |                       Modbus RTU frame format
+ *    --------------------------------------------------------------------------
+ *    | Name      | Length (byte) | Function
+ *    |-----------|---------------|---------------------------------------------
+ *    | Start     |      -        | At least 3.5 character times of silence
+ *    | Address   |      1        | Station address
+ *    | Function  |      1        | Indicates the function codes like read coils / inputs
+ *    | Data      |      n        | Data + length will be filled depending on the message type
+ *    | CRC       |      2        | CRC-16 (polynomial 0xA001), low byte first
+ *    | End       |      -        | At least 3.5 character times of silence
+ *
+ * The slave functions keep their ASCII character positions in RTU mode.  For example
+ * MODBUS_get_Nth_word(5) returns the starting address in either mode.
+ *
+ * A master transaction may be run without blocking.  MODBUS_submit_read or MODBUS_submit_write
+ * starts it and MODBUS_poll, called from loop(), carries it through to the result.
+ * MODBUS_read_registers and MODBUS_put_word do the same and wait for the result.
  */
 
 
@@ -27,6 +48,7 @@
 
     #include <avr/io.h>
     #include <avr/interrupt.h>
+    #include <avr/pgmspace.h>
     #include <stdint.h>
     #include <string.h>
     #include <ctype.h>
@@ -45,25 +67,94 @@
 // Public variables defined
 
     char MODBUS_cmd_line[size_of_cmd_lines];
-    char MODBUS_reply_line[size_of_cmd_lines];
 
 
 // Private functions
 
     void byte_array_2_str(char *line, uint8_t length, uint8_t *hex_array);
     uint16_t LRC_gen(uint8_t *data, uint8_t length);
+    uint16_t CRC_gen(const uint8_t *data, uint8_t length);
     void pack_ASCII_str(char *line, uint8_t *c, uint8_t length);
+    uint8_t pack_RTU_frame(char *line, uint8_t *c, uint8_t N_char);
+    uint8_t pack_frame(char *line, uint8_t *c, uint8_t N_char);
     uint8_t ASCII_hex_2_bin(char c);
+    static inline uint8_t hex_nibble(uint8_t c) __attribute__((always_inline));
+    uint8_t ASCII_hex_2_bytes(uint8_t *D, const char *S, uint8_t N_bytes, uint8_t *LRC);
+    static void bus_release(void);
+    static void bus_take(void);
+    static uint16_t guard_for(uint16_t UBRR, uint8_t U2X, uint8_t bits);
 
 
 // Private alias
 
+    #define HEX_INVALID 0x10                                        // ASCII_hex_2_bin result for a character that is not a hex digit
 
 // Private variables
 
     char digit[ ] = {'0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F'};
     static uint8_t RS_485_dir_pin;
-    static uint8_t USART_timeout_millieseconds;
+    static uint16_t MODBUS_guard_us = MODBUS_GUARD_US;
+    static volatile uint8_t bus_held;                               // a reply is still being encoded, see reply_begin
+    static uint16_t USART_timeout_millieseconds;
+    static uint16_t timeout_floor_ms;                               // see MODBUS_set_adaptive_timeout, 0 = off
+    static uint16_t timeout_ceiling_ms;
+    static uint16_t broadcast_delay_ms = MODBUS_BROADCAST_DELAY_MS;
+    static uint8_t MODBUS_mode = MODBUS_ASCII;
+    static MODBUS_stats_t MODBUS_stats;
+
+    static const uint8_t hex_table[256] PROGMEM = {                 // ASCII hex digit to binary, HEX_INVALID for any other char
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+    };
+
+    static const uint16_t CRC_table[256] PROGMEM = {
+        0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+        0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+        0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+        0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+        0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+        0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+        0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+        0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+        0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+        0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+        0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+        0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+        0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+        0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+        0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+        0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+        0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+        0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+        0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+        0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+        0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+        0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+        0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+        0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+        0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+        0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+        0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+        0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+        0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+        0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+        0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+        0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+    };
 
 
 
@@ -73,25 +164,171 @@
  *
  * @param dir_pin declare the pin used to control the RS-485 transceiver
  *
- * @param timeout set the amount of time (in milliseconds) for the slave to respond.
- *
- * @Warning The USART_ISR must still be called from the main Arduino sketch.
+ * @param timeout set the amount of time (in milliseconds) for the slave to respond.  It is also
+ *        the longest pause allowed within a reply.
  *
- *      ISR(USART_RX_vect){
- *          USART_handle_ISR();
- *      }
+ * @Warning The main Arduino sketch must include USART_instance.h.  It defines the USART driver
+ *          and its ISRs.
  *
  * @warning The ASCII LF is used as the terminator.  Don't forget the ASCII CR
  *          is part of MODBUS and will be held in the buffer.
+ *
+ * @note The bus runs at 19200 baud.  Use MODBUS_INIT_BAUD for other speeds.
  */
     void MODBUS_init(uint8_t dir_pin, uint16_t timeout){
+
+        MODBUS_init_baud(dir_pin, timeout, USART_baud<F_CPU, 19200UL>::UBRR, USART_baud<F_CPU, 19200UL>::U2X);
+    }
+
+
+
+/**
+ * @brief Initialize the MODBUS with a precomputed baud rate setting.  This is normally called
+ * through the MODBUS_INIT_BAUD macro which selects UBRR and U2X at compile time e.g.,
+ *
+ *      MODBUS_INIT_BAUD(RS_485_DIR_PIN, MODBUS_TIMEOUT, 115200UL);
+ *
+ * The compiler stops with an error if the baud rate cannot be generated accurately from the
+ * F_CPU clock.  See USART_baud.h.
+ *
+ * @param UBRR value for the baud rate register
+ *
+ * @param U2X 1 = double speed operation
+ */
+    void MODBUS_init_baud(uint8_t dir_pin, uint16_t timeout, uint16_t UBRR, uint8_t U2X){
         RS_485_dir_pin = dir_pin;
         digitalWrite(dir_pin, LOW);
         pinMode(dir_pin, OUTPUT);
         USART_timeout_millieseconds = timeout;
-        USART_init_full(16000000ul, 19200l, 0x07, 'E');
+        MODBUS_guard_us = guard_for(UBRR, U2X, 10);                 // start, 7 data, parity, and stop bits
+        USART_init_UBRR(UBRR, U2X, 0x07, 'E');
         USART_set_terminator(0x0A);                                 // ASCII LF
+        USART_set_TX_done(bus_release);
+        MODBUS_mode = MODBUS_ASCII;
+
+    }
+
+
+
+/**
+ * @brief Initialize the MODBUS in RTU mode.  This is normally called through the MODBUS_INIT_RTU
+ * macro which also computes the 3.5 character silence that separates frames e.g.,
+ *
+ *      MODBUS_INIT_RTU(RS_485_DIR_PIN, MODBUS_TIMEOUT, 19200UL);
+ *
+ * The USART is configured for 8 data bits with even parity.  The frames are found by timing the
+ * silence between them.  The main sketch must therefore define USART_FRAME_TIMER before it
+ * includes USART_instance.h.  This uses Timer2.
+ *
+ * @param silence_us the idle time that ends a frame, see MODBUS_RTU_SILENCE_US
+ *
+ * @return 1 = success, 0 = failure (the silence timer is not available)
+ */
+    uint8_t MODBUS_init_RTU(uint8_t dir_pin, uint16_t timeout, uint16_t UBRR, uint8_t U2X, uint16_t silence_us){
+
+        RS_485_dir_pin = dir_pin;
+        digitalWrite(dir_pin, LOW);
+        pinMode(dir_pin, OUTPUT);
+        USART_timeout_millieseconds = timeout;
+        MODBUS_guard_us = guard_for(UBRR, U2X, 11);                 // start, 8 data, parity, and stop bits
+        USART_init_UBRR(UBRR, U2X, 0x08, 'E');
+        USART_set_TX_done(bus_release);
+        MODBUS_mode = MODBUS_RTU;
+
+        if (!USART_init_frames(silence_us)){
+            strncpy(ERROR_MSG, "MODBUS_init_RTU: no frame timer", SIZE_ERROR_MSG);
+            return 0x00;
+        }
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Set the RS-485 turnaround guard.  The transceiver is driven for guard_us before the first
+ * character of a message.  It is released guard_us after the final stop bit, from the USART
+ * transmit complete ISR so it does not depend on how soon the main loop runs.
+ *
+ * MODBUS_init sets the guard to MODBUS_GUARD_US or half a character time, whichever is less.  That
+ * keeps the switching glitch of the transceiver clear of the stop bit.  The GS1 takes
+ * approximately 2.5 mS to start a reply so there is ample room.  Call this after MODBUS_init to
+ * change it.
+ *
+ * @warning The release guard is a busy wait inside the ISR.  A guard longer than a character time
+ * lets received characters overrun.
+ */
+    void MODBUS_set_guard(uint16_t guard_us){
+
+        MODBUS_guard_us = guard_us;
+    }
+
+
+
+/**
+ * @brief Called from the USART transmit complete ISR at the end of every message.  The bus is
+ * kept while a reply is still being encoded.  The transmitter can run dry between two of its
+ * pieces.  reply_end then releases the bus.
+ */
+    static void bus_release(void){
+
+        if (bus_held){
+            return;
+        }
+        if (MODBUS_guard_us){
+            delayMicroseconds(MODBUS_guard_us);
+        }
+        digitalWrite(RS_485_dir_pin, BUS_READ);
+    }
+
+
+
+/**
+ * @brief Drive the bus before the first character of a message.
+ */
+    static void bus_take(void){
+
+        digitalWrite(RS_485_dir_pin, BUS_WRITE);
+        if (MODBUS_guard_us){
+            delayMicroseconds(MODBUS_guard_us);
+        }
+    }
+
+
+
+/**
+ * @brief The default turnaround guard for a baud rate setting: MODBUS_GUARD_US or half a
+ * character time, whichever is less.
+ *
+ * @param bits the bits of one character including the start, parity, and stop bits
+ */
+    static uint16_t guard_for(uint16_t UBRR, uint8_t U2X, uint8_t bits){
+
+        uint32_t char_us = (uint32_t) bits * (UBRR + 1) * (U2X ? 8 : 16) * 1000UL / (F_CPU / 1000UL);
+
+        return (char_us / 2 < MODBUS_GUARD_US) ? char_us / 2 : MODBUS_GUARD_US;
+    }
+
+
 
+/**
+ * @brief Retrieve the counts of received messages that were dropped.  Both the slave requests and
+ * the master replies are counted.
+ *
+ *      checksum    the LRC (ASCII) or CRC (RTU) did not match
+ *      invalid     not a MODBUS message e.g., a character that is not a hex digit, a missing ':',
+ *                  or a message too short or too long
+ */
+    void MODBUS_get_stats(MODBUS_stats_t *S){
+
+        *S = MODBUS_stats;
+    }
+
+
+
+    void MODBUS_reset_stats(void){
+
+        MODBUS_stats.checksum = 0;
+        MODBUS_stats.invalid = 0;
     }
 
 
@@ -116,6 +353,67 @@
 
 
 
+/**
+ * @brief This function performs the Cyclic Redundancy Check (CRC) used while the MODBUS is in
+ *        "RTU mode".  The CRC is updated a byte at a time from a 256 entry table held in flash
+ *        rather than a bit at a time.
+ *
+ * @note The CRC of a frame that includes its own CRC (low byte first) is zero.
+ */
+
+    static inline uint16_t CRC_update(uint16_t CRC, uint8_t c){
+
+        return (CRC >> 8) ^ pgm_read_word(&CRC_table[(uint8_t) (CRC ^ c)]);
+    }
+
+
+    uint16_t CRC_gen(const uint8_t *data, uint8_t length){
+
+        uint16_t CRC = 0xFFFF;
+
+        while(length--){
+            CRC = CRC_update(CRC, *data++);
+        }
+        return CRC;
+    }
+
+
+
+/**
+ * @brief Construct a MODBUS RTU frame.  The bytes are copied and the CRC is appended.
+ *
+ * @return the length of the frame in bytes
+ */
+
+    uint8_t pack_RTU_frame(char *line, uint8_t *c, uint8_t N_char){
+
+        uint16_t CRC = CRC_gen(c, N_char);
+
+        memcpy(line, c, N_char);
+        line[N_char] = CRC & 0x00FF;                                // low byte first
+        line[N_char + 1] = CRC >> 8;
+        return N_char + 2;
+    }
+
+
+
+/**
+ * @brief Construct a frame in the current mode.
+ *
+ * @return the number of characters to be sent from line
+ */
+
+    uint8_t pack_frame(char *line, uint8_t *c, uint8_t N_char){
+
+        if (MODBUS_mode == MODBUS_RTU){
+            return pack_RTU_frame(line, c, N_char);
+        }
+        pack_ASCII_str(line, c, N_char);
+        return (N_char << 1) + 5;                                   // ':' + hex + LRC + CR/LF
+    }
+
+
+
 /**
  * @brief Construct a string formatted for a MODBUS device operating in ASCII mode.
  *        Preppend the ':' symbol, converting the bytes to ASCII Hex, and appending the
@@ -132,16 +430,24 @@
  *        required as the input string may contain the NULL char.
  *
  * @note reference the GS1 documentation for more information.
+ *
+ * @note The LRC is accumulated while the bytes are converted.  The source is read only once.
  */
 
     void pack_ASCII_str(char *line, uint8_t *c, uint8_t N_char){
 
-        uint8_t LRC = LRC_gen(c, N_char);
+        uint8_t LRC = 0;
 
         *line++ = ':';
 
-        byte_array_2_str(line, N_char, c);
-        line+= N_char << 1;
+        while(N_char--){                                            // convert and sum in the same pass
+            LRC += *c;
+            *line++ = digit[*c >> 4];
+            *line++ = digit[*c & 0x0F];
+            c++;
+        }
+        LRC = 0 - LRC;                                              // 2's complement, see LRC_gen
+
         *line++ = digit[LRC >> 4];
         *line++ = digit[LRC & 0x0F];
         *line++ = 0x0D;                                             // CR
@@ -182,14 +488,65 @@
  ******************************************************************************/
 
 
+// The transaction in progress, see MODBUS_submit_read, MODBUS_submit_write, MODBUS_submit_write_words,
+// and MODBUS_poll
+
+    #define MASTER_IDLE         0x00
+    #define MASTER_LEAD         0x01                                // driving the bus, waiting to send
+    #define MASTER_SEND         0x02                                // the request is being sent
+    #define MASTER_REPLY        0x03                                // listening for the reply
+    #define MASTER_TURNAROUND   0x04                                // a broadcast was sent, giving the slaves time to act on it
+
+    static uint8_t master_state = MASTER_IDLE;
+    static uint8_t master_request[6];                               // address through the count (or value) of the request
+    static uint8_t master_N_char;                                   // length of the framed request in MODBUS_cmd_line
+    static uint16_t *master_destination;
+    static uint16_t master_n_words;
+    static unsigned long master_t;                                  // start of the current state (uS, mS while listening)
+    static unsigned long master_t_start;                            // uS time stamps for MODBUS_get_latency
+    static unsigned long master_t_sent;
+    static unsigned long master_t_heard;                            // the first character of the reply
+    static uint8_t master_heard;
+    static uint16_t master_timeout_ms;                              // the reply timeout of this transaction
+
+    static uint16_t rx_index;                                       // the reply is checked as it arrives, see master_receive
+    static uint16_t rx_expect;                                      // its length including the LRC or CRC
+    static uint8_t rx_nibble;                                       // the first hex digit of a byte, HEX_INVALID = none
+    static uint8_t rx_high;                                         // the high byte of a word
+    static uint8_t rx_LRC;
+    static uint16_t rx_CRC;
+    static const char *rx_error;                                    // the first fault found, 0 = none
+    static uint8_t rx_invalid;                                      // a character that is not a hex digit
+    static uint8_t rx_started;                                      // the ':' has arrived
+
+    static MODBUS_latency_t latency[MODBUS_LATENCY_SLAVES];
+
+    static uint8_t master_submit(uint8_t slave_addr, uint8_t function, uint16_t addr, uint16_t value, const uint16_t *data);
+    static uint8_t master_wait(void);
+    static uint8_t master_fail(const char *msg);
+    static uint8_t master_receive(void);
+    static uint8_t master_rx_char(char c);
+    static void master_rx_byte(uint8_t b);
+    static void master_rx_start(void);
+    static uint8_t master_rx_check(void);
+    static uint8_t master_done(uint8_t result);
+    static MODBUS_latency_t *latency_slot(uint8_t slave_addr);
+
+
+
 /**
  * @brief This function is used to write a single word to the MODBUS.  An string
  *        is 15 char long plus 2 for terminating characters e.g.,
  *
  *         : 01 06 0100 1770 71 CR LF   (spaces included to separate the fields)
  *
+ * The function blocks until the transaction is complete.  See MODBUS_submit_write for the
+ * non-blocking equivalent.
+ *
  * @param slave_addr a byte identifying a particular MODBUS device.  Note
  *        this must be manually programmed into a device such as the GS1.
+ *        MODBUS_BROADCAST_ADDR writes the register of every slave at once.  No
+ *        slave replies, see MODBUS_set_broadcast_delay.
  *
  * @param mem_addr a 16-bit value identifying the particular MODBUS register to
  *        be written
@@ -199,54 +556,17 @@
  * @return result of operation, 1 = success, 0 = failure
  *
  * @note  There is a glitch as the RS-485 transceiver transitions from XMT to
- *        RCV.  This delay moves the transition outside of the GS1's observation
- *        window.  Note that the GS1 takes approximately 2.5 mS to start reply.
+ *        RCV.  The turnaround guard keeps it clear of the message.  See
+ *        MODBUS_set_guard.
  */
 
     uint8_t MODBUS_put_word(uint8_t slave_addr, uint16_t mem_addr, uint16_t data){
 
-        #define match 0x00
-
-        uint8_t mem_addr_h = mem_addr >> 8;
-        uint8_t mem_addr_l = mem_addr & 0x00FF;
-
-        uint8_t data_h = data >> 8;
-        uint8_t data_l = data & 0x00FF;
-
-        uint8_t cmd_str_hex[] = { slave_addr, PRESET_SINGLE_REGISTER, mem_addr_h, mem_addr_l, data_h, data_l } ;
-
-        uint16_t milisecond_cnt;
-
-        pack_ASCII_str(MODBUS_cmd_line, cmd_str_hex, 6);
-
-    // Write the word
-
-        digitalWrite(RS_485_dir_pin, BUS_WRITE);
-        delayMicroseconds(1000);
-        USART_puts(MODBUS_cmd_line);
-        delayMicroseconds(1500);
-        digitalWrite(RS_485_dir_pin, BUS_READ);
-
-    // Verify the word was written by analyzing the echo
-
-        milisecond_cnt = 0;
-        while(!USART_is_string( )){
-            delay(1);
-            if (++milisecond_cnt > USART_timeout_millieseconds){                                // prevent lockup if device is not connected
-                strncpy(ERROR_MSG, "MODBUS_put_word: USART timeout", SIZE_ERROR_MSG);
-                return 0x00;
-            }
-        }
-
-        USART_gets(MODBUS_reply_line);
-
-        if(strncmp(MODBUS_cmd_line, MODBUS_reply_line, 15) == match){   // limit to the first 15 characters (no need to test the line terminators)
-            return 0x01;
-        }
-        else{
+        if (!MODBUS_submit_write(slave_addr, mem_addr, data)){
+            strncpy(ERROR_MSG, "MODBUS_put_word: transaction in progress", SIZE_ERROR_MSG);
             return 0x00;
-            strncpy(ERROR_MSG, "MODBUS_put_word: improper return from device", SIZE_ERROR_MSG);
         }
+        return master_wait();
     }
 
 
@@ -255,12 +575,8 @@
 /**
  * @brief This function is used to read registers from MODBUS
  *
- * FIXME From the GS1 documentation page 5-72:
- *
- * FIXME Example Message:
- *      Write a value of 60Hz to P9.26 and a value of 1 to P9.27 =
- *      01 10 09 1b 00 02 04 02 58 00 01 5a 66
- *      We receive a good reply = 01 10 09 1b 00 02 a3 9f
+ * The function blocks until the transaction is complete.  See MODBUS_submit_read for the
+ * non-blocking equivalent.
  *
  * @param destination a pointer to the location the returned values will be placed
  *
@@ -269,141 +585,959 @@
  *
  * @param starting_mem_addr a 16-bit value identifying the first address to be read
  *
- * @param get_n_words identify the number of words to be read from the addressed MODBUS device
+ * @param get_n_words identify the number of words to be read from the addressed MODBUS device,
+ *        1 through MODBUS_MAX_READ_WORDS.  The reply is decoded into destination as it arrives so
+ *        its length is not limited by any buffer.  On failure destination may hold part of it.
  *
  * @note  There is a glitch as the RS-485 transceiver transitions from XMT to RCV.
- *        This delay moves the transition outside of the GS1's observation window.
- *        Note that the GS1 takes approximately 2.5 mS to start a reply.
+ *        The turnaround guard keeps it clear of the message.  See MODBUS_set_guard.
  */
 
    uint8_t MODBUS_read_registers(uint16_t *destination, uint8_t slave_addr, uint16_t starting_mem_addr, uint16_t get_n_words ) {
 
-        uint8_t starting_mem_addr_h = starting_mem_addr >> 8;
-        uint8_t starting_mem_addr_l = starting_mem_addr & 0x00FF;
+        if (!MODBUS_submit_read(destination, slave_addr, starting_mem_addr, get_n_words)){
+            return 0x00;                                            // ERROR_MSG is already set
+        }
+        return master_wait();
+}
 
-        uint8_t get_n_words_h = get_n_words >> 8;
-        uint8_t get_n_words_l = get_n_words & 0x00FF;
 
-        uint8_t cmd_str_hex[] = { slave_addr, READ_HOLDING_REGISTERS, starting_mem_addr_h, starting_mem_addr_l, get_n_words_h, get_n_words_l } ;
 
-        uint16_t milisecond_cnt;
+/**
+ * @brief Write contiguous registers in a single transaction (function 0x10, preset multiple
+ * registers).  From the GS1 documentation page 5-72:
+ *
+ *      Write a value of 60Hz to P9.26 and a value of 1 to P9.27 =
+ *      01 10 09 1b 00 02 04 02 58 00 01 5a 66
+ *      We receive a good reply = 01 10 09 1b 00 02 a3 9f
+ *
+ * The CRCs printed in the documentation are wrong.  The frames above end in 98 eb and 32 53.
+ *
+ * The slave replies with the address, function, starting address, and number of registers.
+ *
+ * The function blocks until the transaction is complete.  See MODBUS_submit_write_words for the
+ * non-blocking equivalent.
+ *
+ * @param starting_mem_addr the register that receives data[0]
+ *
+ * @param n_words number of registers, 1 through MODBUS_MAX_PUT_WORDS.  In ASCII a request of more
+ *        than 14 registers is longer than the default 64 byte transmit buffer.  MODBUS_poll then
+ *        waits, in the call that sends it, until the rest of the request fits.
+ *
+ * @param data the values to be written
+ *
+ * @return result of operation, 1 = success, 0 = failure
+ */
+    uint8_t MODBUS_put_words(uint8_t slave_addr, uint16_t starting_mem_addr, uint16_t n_words, const uint16_t *data){
 
-        pack_ASCII_str(MODBUS_cmd_line, cmd_str_hex, 6);
+        if (!MODBUS_submit_write_words(slave_addr, starting_mem_addr, n_words, data)){
+            return 0x00;                                            // ERROR_MSG is already set
+        }
+        return master_wait();
+    }
 
-    // Send the request for N words of data
 
-        digitalWrite(RS_485_dir_pin, BUS_WRITE);
-        delayMicroseconds(1000);
-        USART_puts(MODBUS_cmd_line);
-        delayMicroseconds(1500);
-        digitalWrite(RS_485_dir_pin, BUS_READ);
 
-    // Verify the word was written by analyzing the echo
+/**
+ * @brief Start reading registers without waiting for the reply.  The transaction is carried out
+ * by MODBUS_poll which must be called from loop().  The words in destination are valid once
+ * MODBUS_poll returns MODBUS_DONE.
+ *
+ * \b Example:
+ *    @code
+ *          void loop(){
+ *
+ *              switch (MODBUS_poll()){
+ *
+ *                  case MODBUS_IDLE:                               // start the next transaction
+ *                      MODBUS_submit_read(&speed, GS1_ADDR, 0x2103, 1);
+ *                      break;
+ *
+ *                  case MODBUS_DONE:                               // speed has been updated
+ *                      break;
+ *
+ *                  case MODBUS_FAILED:                             // see ERROR_MSG
+ *                      break;
+ *              }
+ *
+ *              // other work e.g., the ADC and the LCD
+ *          }
+ *    @endcode
+ *
+ * @param destination must remain valid until the transaction is complete.  The words are written
+ *        as they arrive.  If the transaction fails it may hold part of the reply.
+ *
+ * @return 1 = started, 0 = a transaction is already in progress or get_n_words is out of range
+ *         (see ERROR_MSG)
+ */
+    uint8_t MODBUS_submit_read(uint16_t *destination, uint8_t slave_addr, uint16_t starting_mem_addr, uint16_t get_n_words){
 
-        milisecond_cnt = 0;
-        while(!USART_is_string( )){
-            delay(1);
-            if (++milisecond_cnt == USART_TIMEOUT_MILLISECONDS){         // prevent lockup if device is not connected
-                strncpy(ERROR_MSG, "MODBUS_read_reg: USART timeout", SIZE_ERROR_MSG);
-                return 0x00;
-            }
+        if ((get_n_words == 0) || (get_n_words > MODBUS_MAX_READ_WORDS)){
+            strncpy(ERROR_MSG, "MODBUS_read_reg: number of words out of range", SIZE_ERROR_MSG);
+            return 0x00;
         }
-
-        USART_gets(MODBUS_reply_line);
-
-    // Verify first 5 ASCII characters of response are correct
-
-        if(strncmp(MODBUS_cmd_line, MODBUS_reply_line, 5) != match){   // limit to the first 15 characters (no need to test the line terminators)
-            strncpy(ERROR_MSG, "MODBUS_read_reg: first 5 characters don't match", SIZE_ERROR_MSG);
+        if (slave_addr == MODBUS_BROADCAST_ADDR){
+            strncpy(ERROR_MSG, "MODBUS_read_reg: a broadcast cannot be read", SIZE_ERROR_MSG);
             return 0x00;
         }
+        if (!master_submit(slave_addr, READ_HOLDING_REGISTERS, starting_mem_addr, get_n_words, 0)){
+            strncpy(ERROR_MSG, "MODBUS_read_reg: transaction in progress", SIZE_ERROR_MSG);
+            return 0x00;
+        }
+        master_destination = destination;
+        master_n_words = get_n_words;
+        return 0x01;
+    }
 
-    // Verify the number bytes received equals number of bytes requested
 
-        uint16_t num_bytes_received = (ASCII_hex_2_bin(MODBUS_reply_line[5]) << 8) + ASCII_hex_2_bin(MODBUS_reply_line[6]);
 
-        if (num_bytes_received !=  (get_n_words << 1)){
-            strncpy(ERROR_MSG, "MODBUS_read_reg: improper number words returned", SIZE_ERROR_MSG);
-            return 0x00;
-        }
+/**
+ * @brief Start writing a single register without waiting for the echo.  See MODBUS_submit_read.
+ *
+ * @return 1 = started, 0 = a transaction is already in progress
+ */
+    uint8_t MODBUS_submit_write(uint8_t slave_addr, uint16_t mem_addr, uint16_t data){
 
-    // Put the received words into the destination buffer
+        return master_submit(slave_addr, PRESET_SINGLE_REGISTER, mem_addr, data, 0);
+    }
 
-        uint16_t temp;
 
-        for (uint16_t i = 0; i < get_n_words * 4; i = i + 4){
 
-            temp =  ASCII_hex_2_bin(MODBUS_reply_line[i + 7]) << 12;
-            temp += ASCII_hex_2_bin(MODBUS_reply_line[i + 8]) << 8;
-            temp += ASCII_hex_2_bin(MODBUS_reply_line[i + 9]) << 4;
-            temp += ASCII_hex_2_bin(MODBUS_reply_line[i + 10]);
+/**
+ * @brief Start writing contiguous registers without waiting for the reply.  See MODBUS_put_words
+ * and MODBUS_submit_read.  The data is framed before the function returns.  It need not remain
+ * valid.
+ *
+ * @return 1 = started, 0 = a transaction is already in progress or n_words is out of range (see
+ *         ERROR_MSG)
+ */
+    uint8_t MODBUS_submit_write_words(uint8_t slave_addr, uint16_t starting_mem_addr, uint16_t n_words, const uint16_t *data){
 
-            *destination = temp;
-            destination++;
+        if ((n_words == 0) || (n_words > MODBUS_MAX_PUT_WORDS)){
+            strncpy(ERROR_MSG, "MODBUS_put_words: number of words out of range", SIZE_ERROR_MSG);
+            return 0x00;
+        }
+        if (!master_submit(slave_addr, PRESET_MULTIPLE_REGISTERS, starting_mem_addr, n_words, data)){
+            strncpy(ERROR_MSG, "MODBUS_put_words: transaction in progress", SIZE_ERROR_MSG);
+            return 0x00;
         }
         return 0x01;
+    }
 
-}
 
 
-/*******************************************************************************
+/**
+ * @brief Advance the transaction in progress.  Each call does a small amount of work and returns.
+ * Nothing is waited for.
  *
- *       _______. __          ___   ____    ____  _______
- *      /       ||  |        /   \  \   \  /   / |   ____|
- *     |   (----`|  |       /  ^  \  \   \/   /  |  |__
- *      \   \    |  |      /  /_\  \  \      /   |   __|
- *  .----)   |   |  `----./  _____  \  \    /    |  |____
- *  |_______/    |_______/__/     \__\  \__/     |_______|
+ *      lead        the transceiver drives the bus for the guard time before the request is sent
+ *      send        the request is queued with USART_nb_write and goes out under interrupt.  The
+ *                  transmit complete ISR releases the bus (see MODBUS_set_guard).  The
+ *                  transaction fails if that does not happen within the timeout.
+ *      reply       the reply is decoded as it arrives, for up to the reply timeout (see
+ *                  MODBUS_init and MODBUS_set_adaptive_timeout)
+ *      turnaround  in place of the reply when the request was a broadcast.  No slave answers.  The
+ *                  bus is kept quiet for the broadcast delay (see MODBUS_set_broadcast_delay).
  *
- ******************************************************************************/
-
+ * @return MODBUS_IDLE = no transaction, MODBUS_BUSY = in progress, MODBUS_DONE = the transaction
+ *         succeeded, MODBUS_FAILED = the transaction failed (see ERROR_MSG).  MODBUS_DONE and
+ *         MODBUS_FAILED are returned once.  The next call returns MODBUS_IDLE.
+ */
+    uint8_t MODBUS_poll(void){
+
+        switch(master_state){
+
+            case MASTER_LEAD:
+                if (micros() - master_t < MODBUS_guard_us){
+                    return MODBUS_BUSY;
+                }
+                USART_nb_write(MODBUS_cmd_line, master_N_char);
+                master_t = millis();
+                master_state = MASTER_SEND;
+                return MODBUS_BUSY;
+
+            case MASTER_SEND:
+                if (!USART_is_TX_idle()){                           // the bus is released by bus_release
+                    if (millis() - master_t <= USART_timeout_millieseconds){
+                        return MODBUS_BUSY;
+                    }
+                    master_state = MASTER_IDLE;                     // the transmit complete interrupt never came
+                    digitalWrite(RS_485_dir_pin, BUS_READ);
+                    strncpy(ERROR_MSG, "MODBUS_poll: transmit timeout", SIZE_ERROR_MSG);
+                    return MODBUS_FAILED;
+                }
+                master_t = millis();
+                master_t_sent = micros();
+                master_state = (master_request[0] == MODBUS_BROADCAST_ADDR) ? MASTER_TURNAROUND : MASTER_REPLY;
+                return MODBUS_BUSY;
+
+            case MASTER_REPLY:
+                if (!master_receive()){
+                    if (millis() - master_t <= master_timeout_ms){
+                        return MODBUS_BUSY;
+                    }
+                    master_state = MASTER_IDLE;                     // prevent lockup if device is not connected
+                    return master_done(master_fail(": USART timeout"));
+                }
+                master_state = MASTER_IDLE;
+                return master_done(master_rx_check() ? MODBUS_DONE : MODBUS_FAILED);
+
+            case MASTER_TURNAROUND:
+                if (millis() - master_t < broadcast_delay_ms){
+                    return MODBUS_BUSY;
+                }
+                master_state = MASTER_IDLE;
+                return MODBUS_DONE;                                 // nothing to check, see MODBUS_set_broadcast_delay
+
+            default:
+                return MODBUS_IDLE;
+        }
+    }
 
-    static char MODBUS_str[size_of_cmd_lines];
-    static uint8_t num_char;
 
 
 /**
-* @brief Convert an ASCII codex hex character into its integer equivalent
-*
-* @param a hex character in ASCII form
-*
-* @return an unsigned integer
-*/
-    uint8_t ASCII_hex_2_bin(char c) {
+ * @brief Copy the reply times of a slave.  The master keeps them for the first
+ * MODBUS_LATENCY_SLAVES slaves it addresses.  A transaction is split in three:
+ *
+ *      send        the guard time and the request on the wire, until the transmit complete
+ *                  interrupt
+ *      response    the slave's turnaround, until the first character of the reply arrives
+ *      reply       the reply on the wire, until it is complete and checked
+ *
+ * The mean of each is its sum divided by count.  The minimum, maximum, and histogram are of the
+ * response and the reply together.  They are only as fine as the calls to MODBUS_poll.  When a
+ * count or sum nears its limit every count and sum of the slave is halved so the figures favour
+ * recent transactions.
+ *
+ * \b Example:
+ *    @code
+ *          MODBUS_latency_t L;
+ *
+ *          if (MODBUS_get_latency(GS1_ADDR, &L) && L.count){
+ *              snprintf(line, BB_serial_max_char, "%u replies, %lu / %lu / %lu uS, %u failed\n",
+ *                       L.count, L.min_us, (L.response_sum_us + L.reply_sum_us) / L.count, L.max_us, L.failed);
+ *              BB_serial.print(line);
+ *          }
+ *    @endcode
+ *
+ * @return 1 = success, 0 = the slave has not been addressed or is not tracked
+ */
+    uint8_t MODBUS_get_latency(uint8_t physical_addr, MODBUS_latency_t *L){
 
-        if (c <= '9'){
-            return c - '0';
+        for (uint8_t i = 0; i < MODBUS_LATENCY_SLAVES; i++){
+            if (physical_addr && (latency[i].slave_addr == physical_addr)){
+                *L = latency[i];
+                return 0x01;
+            }
         }
-        return (c - 'A') + 10;
-
+        return 0x00;
     }
 
 
 
+    void MODBUS_reset_latency(void){
 
+        memset(latency, 0, sizeof(latency));
+    }
 
 
 
+/**
+ * @brief Derive the reply timeout of each slave from its own reply times instead of using the
+ * single timeout given to MODBUS_init.  A dead slave is then detected a few mS after its normal
+ * reply window rather than after the worst case of every slave on the bus.  As in TCP:
+ *
+ *      smooth      += (response - smooth) / 8
+ *      deviation   += (|response - smooth| - deviation) / 4
+ *      timeout      = smooth + 4 * deviation, limited to floor_ms through ceiling_ms
+ *
+ * where response is the time from the end of the request to the first character of the reply
+ * (see MODBUS_get_latency).  Like the fixed timeout it also limits the pauses within the reply so
+ * a long reply is not cut short.  Each timeout doubles the deviation so a slave that has slowed
+ * down is soon given more time.  The ceiling is used until the slave has replied once, and for
+ * the slaves beyond MODBUS_LATENCY_SLAVES.
+ *
+ * @param floor_ms the shortest timeout.  Allow for the resolution of millis() and for how often
+ *        MODBUS_poll is called.
+ *
+ * @param ceiling_ms the longest timeout, 0 = use the timeout given to MODBUS_init for every slave
+ */
+    void MODBUS_set_adaptive_timeout(uint16_t floor_ms, uint16_t ceiling_ms){
 
+        timeout_floor_ms = (floor_ms < ceiling_ms) ? floor_ms : ceiling_ms;
+        timeout_ceiling_ms = ceiling_ms;
+    }
 
- /**
-  * @brief Determine if a valid MODBUS message has been received.  On successful retrieval the 
-  * message is held in a local MODBUS_str[] buffer.
-  *
-  * @return 0 = no new message, 1 = a valid message had been retrieved
-  */
-    uint8_t MODBUS_slave_is_new_msg(void){
 
-        if (!USART_is_string())
-            return 0x00;
 
-        num_char =  USART_gets(MODBUS_str);
+/**
+ * @return the reply timeout in mS the next transaction with the slave will use
+ */
+    uint16_t MODBUS_get_timeout(uint8_t physical_addr){
 
-        // TODO add code to verify the LRC
+        MODBUS_latency_t *L;
+        uint32_t timeout;
 
-        return 0x01;
+        if (!timeout_ceiling_ms){
+            return USART_timeout_millieseconds;
+        }
 
-    }
+        L = latency_slot(physical_addr);
+        if (!L || !L->count){
+            return timeout_ceiling_ms;
+        }
+
+        timeout = (L->smooth_us + 4 * L->deviation_us) / 1000 + 1; // round up
+        if (timeout < timeout_floor_ms)
+            return timeout_floor_ms;
+        if (timeout > timeout_ceiling_ms)
+            return timeout_ceiling_ms;
+        return timeout;
+    }
+
+
+
+/**
+ * @brief Set the time the master waits after a broadcast before it starts the next transaction.
+ * A write to MODBUS_BROADCAST_ADDR is acted on by every slave and answered by none, so the
+ * transaction is done once the request has been sent.  The slaves still need time to process it
+ * before they can take another request.  The MODBUS specification calls this the turnaround delay.
+ *
+ * The delay is not a timeout.  MODBUS_DONE after a broadcast means the request was sent, not that
+ * any slave received it.  Read back from each slave when that matters.
+ *
+ * @param delay_ms default MODBUS_BROADCAST_DELAY_MS
+ */
+    void MODBUS_set_broadcast_delay(uint16_t delay_ms){
+
+        broadcast_delay_ms = delay_ms;
+    }
+
+
+
+/**
+ * @brief Frame the request and take the bus.
+ *
+ * @param value the register value (0x06) or the number of registers (0x03 and 0x10)
+ *
+ * @param data the register values for 0x10, otherwise 0
+ */
+    static uint8_t master_submit(uint8_t slave_addr, uint8_t function, uint16_t addr, uint16_t value, const uint16_t *data){
+
+        uint8_t frame[7 + 2 * MODBUS_MAX_PUT_WORDS];
+        uint8_t N_bytes = 6;
+
+        if (master_state != MASTER_IDLE){
+            return 0x00;
+        }
+
+        master_request[0] = frame[0] = slave_addr;
+        master_request[1] = frame[1] = function;
+        master_request[2] = frame[2] = addr >> 8;
+        master_request[3] = frame[3] = addr & 0x00FF;
+        master_request[4] = frame[4] = value >> 8;
+        master_request[5] = frame[5] = value & 0x00FF;
+
+        if (data){                                                  // preset multiple registers
+            frame[N_bytes++] = value << 1;                          // byte count
+            while (value--){
+                frame[N_bytes++] = *data >> 8;
+                frame[N_bytes++] = *data & 0x00FF;
+                data++;
+            }
+        }
+        master_N_char = pack_frame(MODBUS_cmd_line, frame, N_bytes);
+
+        digitalWrite(RS_485_dir_pin, BUS_WRITE);
+        master_t = micros();
+        master_t_start = master_t;
+        master_heard = 0;
+        master_timeout_ms = MODBUS_get_timeout(slave_addr);
+        master_rx_start();
+        master_state = MASTER_LEAD;
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Run the transaction to completion.  Used by the blocking functions.
+ */
+    static uint8_t master_wait(void){
+
+        uint8_t result;
+
+        while((result = MODBUS_poll()) == MODBUS_BUSY);
+
+        return (result == MODBUS_DONE);
+    }
+
+
+
+/**
+ * @brief Report a failed transaction.  The name of the blocking function is placed in front of msg
+ * e.g., "MODBUS_read_reg: CRC error".
+ *
+ * @return MODBUS_FAILED
+ */
+    static uint8_t master_fail(const char *msg){
+
+        if (master_request[1] == PRESET_SINGLE_REGISTER)
+            strncpy(ERROR_MSG, "MODBUS_put_word", SIZE_ERROR_MSG);
+        else if (master_request[1] == PRESET_MULTIPLE_REGISTERS)
+            strncpy(ERROR_MSG, "MODBUS_put_words", SIZE_ERROR_MSG);
+        else
+            strncpy(ERROR_MSG, "MODBUS_read_reg", SIZE_ERROR_MSG);
+
+        strncat(ERROR_MSG, msg, SIZE_ERROR_MSG - strlen(ERROR_MSG) - 1);
+        return MODBUS_FAILED;
+    }
+
+
+
+/**
+ * @brief Take the reply from the USART as it arrives.  Nothing is waited for.
+ *
+ * @return 1 = the reply is complete (the LF in ASCII mode, the end of the frame in RTU mode), 0 =
+ *         more is to come
+ */
+    static uint8_t master_receive(void){
+
+        char buf[16];
+        uint8_t n;
+        uint8_t end;
+
+        do{
+            n = USART_read(buf, sizeof(buf), &end);
+            if (n){
+                master_t = millis();                                // the timeout limits the silence, not the length of the reply
+                if (!master_heard){
+                    master_t_heard = micros();
+                    master_heard = 1;
+                }
+            }
+
+            for (uint8_t i = 0; i < n; i++){
+                if (MODBUS_mode == MODBUS_RTU){
+                    rx_CRC = CRC_update(rx_CRC, buf[i]);
+                    master_rx_byte(buf[i]);
+                }
+                else if (master_rx_char(buf[i])){
+                    return 0x01;
+                }
+            }
+            if (end && (MODBUS_mode == MODBUS_RTU)){                 // the frame may end after its last byte was taken
+                return 0x01;
+            }
+        } while (n);
+
+        return 0x00;
+    }
+
+
+
+/**
+ * @brief Convert an ASCII reply two hex digits at a time.  Anything before the ':' is ignored.
+ *
+ * @return 1 = the LF that ends the reply, 0 = otherwise
+ */
+    static uint8_t master_rx_char(char c){
+
+        uint8_t d;
+
+        if (c == ':'){                                              // start again from here
+            master_rx_start();
+            rx_started = 1;
+            return 0x00;
+        }
+        if (!rx_started || (c == 0x0D)){
+            return 0x00;
+        }
+        if (c == 0x0A){
+            return 0x01;
+        }
+
+        d = hex_nibble(c);
+        if (d == HEX_INVALID){
+            rx_invalid = 1;
+        }
+        else if (rx_nibble == HEX_INVALID){
+            rx_nibble = d;
+        }
+        else{
+            d |= rx_nibble << 4;
+            rx_nibble = HEX_INVALID;
+            rx_LRC += d;
+            master_rx_byte(d);
+        }
+        return 0x00;
+    }
+
+
+
+/**
+ * @brief Check one byte of the reply against the request.  The words of a read go straight into
+ * the destination.  The length of the reply is known once the function code has arrived.
+ */
+    static void master_rx_byte(uint8_t b){
+
+        uint16_t i = rx_index;
+
+        if (rx_index < 0xFFFF){
+            rx_index++;
+        }
+
+        if (i == 0){
+            if (b != master_request[0]){
+                rx_error = ": first 2 bytes don't match";
+            }
+            return;
+        }
+
+        if (i == 1){
+            if (b == master_request[1]){
+                rx_expect = (b == READ_HOLDING_REGISTERS) ? 3 + (master_n_words << 1) : 6;
+            }
+            else if (b == (master_request[1] | 0x80)){
+                rx_expect = 3;                                      // address, function, exception code
+                if (!rx_error){
+                    rx_error = ": exception reply";
+                }
+            }
+            else if (!rx_error){
+                rx_error = ": first 2 bytes don't match";
+            }
+            rx_expect += (MODBUS_mode == MODBUS_RTU) ? 2 : 1;       // the CRC or LRC
+            return;
+        }
+
+        if (rx_error || (i >= rx_expect - ((MODBUS_mode == MODBUS_RTU) ? 2 : 1))){
+            return;                                                 // no longer of interest, or the LRC or CRC
+        }
+
+        if (master_request[1] != READ_HOLDING_REGISTERS){
+            if (b != master_request[i]){                            // the echo, or the address and count
+                rx_error = ": improper return from device";
+            }
+        }
+        else if (i == 2){
+            if (b != (master_n_words << 1)){
+                rx_error = ": improper number words returned";
+            }
+        }
+        else if (i & 0x01){                                         // the high byte of a word
+            rx_high = b;
+        }
+        else{
+            master_destination[(i - 3) >> 1] = (rx_high << 8) + b;
+        }
+    }
+
+
+
+/**
+ * @brief Prepare for the next reply.
+ */
+    static void master_rx_start(void){
+
+        rx_index = 0;
+        rx_expect = 0xFFFF;
+        rx_nibble = HEX_INVALID;
+        rx_LRC = 0;
+        rx_CRC = 0xFFFF;
+        rx_error = 0;
+        rx_invalid = 0;
+        rx_started = 0;
+    }
+
+
+
+/**
+ * @brief Judge the reply once it is complete.  The checksum is tested first.  A reply that fails
+ * it is not examined further.
+ */
+    static uint8_t master_rx_check(void){
+
+        if (rx_invalid || (rx_nibble != HEX_INVALID) || ((MODBUS_mode != MODBUS_RTU) && !rx_started)){
+            MODBUS_stats.invalid++;
+            master_fail(": invalid character in reply");
+            return 0x00;
+        }
+        if (rx_index < 3){
+            MODBUS_stats.invalid++;
+            master_fail(": reply too short");
+            return 0x00;
+        }
+        if (MODBUS_mode == MODBUS_RTU ? (rx_CRC != 0) : (rx_LRC != 0)){
+            MODBUS_stats.checksum++;
+            master_fail(MODBUS_mode == MODBUS_RTU ? ": CRC error" : ": LRC error");
+            return 0x00;
+        }
+        if (rx_error){
+            master_fail(rx_error);
+            return 0x00;
+        }
+        if (rx_index != rx_expect){
+            master_fail((master_request[1] == READ_HOLDING_REGISTERS) ? ": improper number words returned" :
+                                                                        ": improper return from device");
+            return 0x00;
+        }
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Record the times of the transaction that has just ended.  See MODBUS_get_latency.
+ *
+ * @return result
+ */
+    static uint8_t master_done(uint8_t result){
+
+        unsigned long now = micros();
+        unsigned long wait = now - master_t_sent;
+        MODBUS_latency_t *L = latency_slot(master_request[0]);
+        uint8_t bucket = 0;
+
+        if (!L){
+            return result;
+        }
+        if (result != MODBUS_DONE){
+            L->failed++;
+            if (L->deviation_us < 0x10000000UL){                    // no reply or a bad one, allow more time
+                L->deviation_us = (L->deviation_us << 1) + 1000;
+            }
+            return result;
+        }
+        if (!master_heard){                                         // the whole reply arrived between two calls
+            master_t_heard = now;
+        }
+
+        if ((L->count == 0xFFFF) || ((L->send_sum_us | L->response_sum_us | L->reply_sum_us) & 0x80000000UL)){
+            L->count >>= 1;
+            L->failed >>= 1;
+            L->send_sum_us >>= 1;
+            L->response_sum_us >>= 1;
+            L->reply_sum_us >>= 1;
+            for (uint8_t i = 0; i < MODBUS_LATENCY_BUCKETS; i++){
+                L->histogram[i] >>= 1;
+            }
+        }
+
+        if (L->count == 0){
+            L->smooth_us = master_t_heard - master_t_sent;
+            L->deviation_us = L->smooth_us >> 1;
+        }
+        else{
+            long error = (long) (master_t_heard - master_t_sent - L->smooth_us);
+
+            L->smooth_us += error / 8;
+            L->deviation_us += ((error < 0 ? -error : error) - (long) L->deviation_us) / 4;
+        }
+
+        if ((L->count == 0) || (wait < L->min_us))
+            L->min_us = wait;
+        if (wait > L->max_us)
+            L->max_us = wait;
+        L->count++;
+        L->send_sum_us += master_t_sent - master_t_start;
+        L->response_sum_us += master_t_heard - master_t_sent;
+        L->reply_sum_us += now - master_t_heard;
+
+        while ((bucket < MODBUS_LATENCY_BUCKETS - 1) && (wait >= ((unsigned long) MODBUS_LATENCY_BUCKET_US << bucket))){
+            bucket++;
+        }
+        L->histogram[bucket]++;
+        return result;
+    }
+
+
+
+/**
+ * @return the record of the slave, a free record, or 0 = none is free
+ */
+    static MODBUS_latency_t *latency_slot(uint8_t slave_addr){
+
+        MODBUS_latency_t *free_slot = 0;
+
+        if (!slave_addr){                                           // a broadcast is never answered
+            return 0;
+        }
+
+        for (uint8_t i = 0; i < MODBUS_LATENCY_SLAVES; i++){
+            if (latency[i].slave_addr == slave_addr){
+                return &latency[i];
+            }
+            if (!free_slot && !latency[i].slave_addr){
+                free_slot = &latency[i];
+            }
+        }
+        if (free_slot){
+            free_slot->slave_addr = slave_addr;
+        }
+        return free_slot;
+    }
+
+
+/*******************************************************************************
+ *
+ *       _______. __          ___   ____    ____  _______
+ *      /       ||  |        /   \  \   \  /   / |   ____|
+ *     |   (----`|  |       /  ^  \  \   \/   /  |  |__
+ *      \   \    |  |      /  /_\  \  \      /   |   __|
+ *  .----)   |   |  `----./  _____  \  \    /    |  |____
+ *  |_______/    |_______/__/     \__\  \__/     |_______|
+ *
+ ******************************************************************************/
+
+
+    static USART_line_t MODBUS_line;                                // the current message, in place in the USART buffer
+    static uint8_t MODBUS_line_held = 0;
+    static uint8_t num_char;
+    static uint8_t MODBUS_frame[MODBUS_FRAME_LEN];                  // the current message converted to bytes
+    static uint8_t MODBUS_frame_len;                                // address through data, without the LRC or CRC
+
+    static const MODBUS_range_t *slave_map;                         // see MODBUS_slave_map
+    static uint8_t slave_map_N;
+    static uint8_t slave_address;
+
+    static char reply_buf[16];                                      // a reply is encoded here and sent in pieces
+    static uint16_t read_ahead[MODBUS_READ_AHEAD];                  // register values of the reply, see map_read
+    static uint8_t reply_N;
+    static uint8_t reply_LRC;
+    static uint16_t reply_CRC;
+
+    typedef struct {                                                // an encoded read reply, see MODBUS_CACHE_REPLY
+        uint16_t addr;
+        uint16_t N;
+        uint8_t len;                                                // 0 = empty
+        uint8_t used;                                               // sent since it was last passed over for replacement
+        char frame[MODBUS_REPLY_CACHE_LEN];
+    } reply_frame_t;
+
+    static reply_frame_t reply_cache[MODBUS_REPLY_CACHE];
+    static uint8_t reply_cache_next;                                // the next to be replaced
+    static reply_frame_t *reply_capture;                            // the reply being encoded is kept here, 0 = not kept
+    static uint8_t reply_capture_N;
+
+    static uint8_t decode_ASCII_line(void);
+    static uint8_t decode_RTU_line(void);
+    static void reply_begin(void);
+    static void reply_byte(uint8_t b);
+    static void reply_end(void);
+    static void reply_send(void);
+    static void reply_exception(uint8_t code);
+    static uint8_t reply_cached(const MODBUS_range_t *R, uint16_t addr, uint16_t N);
+    static void reply_invalidate(uint16_t addr);
+    static const MODBUS_range_t *map_find(uint16_t addr, uint16_t N, uint8_t write);
+    static uint8_t map_read(const MODBUS_range_t *R, uint16_t addr, uint16_t N);
+    static void service_read(void);
+    static void service_write_single(void);
+    static void service_write_multiple(void);
+
+
+/**
+* @brief Convert an ASCII codex hex character into its integer equivalent.  Both upper and lower
+* case are accepted.
+*
+* @param a hex character in ASCII form
+*
+* @return an unsigned integer, HEX_INVALID if c is not a hex digit
+*/
+    uint8_t ASCII_hex_2_bin(char c) {
+
+        return hex_nibble(c);
+
+    }
+
+
+
+/**
+ * @brief ASCII_hex_2_bin expanded in place.  The conversion loops call this so that each digit
+ * costs one table read rather than a function call.
+ */
+    static inline uint8_t hex_nibble(uint8_t c){
+
+        return pgm_read_byte(&hex_table[c]);
+    }
+
+
+
+/**
+ * @brief Convert N_bytes pairs of ASCII hex characters to bytes in a single pass.  Invalid
+ * characters are not tested one at a time.  Every digit is ORed into a single flag which is
+ * checked once at the end.
+ *
+ * The bytes are summed as they are converted.  When S is a complete frame including its LRC the
+ * sum is 0.  Checking the LRC is then a single compare with no second pass over the frame.
+ *
+ * @param D destination.  It may be the same buffer as S.  Each byte is written behind the
+ *        characters still to be read.
+ *
+ * @param S source containing 2 * N_bytes hex characters
+ *
+ * @param LRC receives the modulo 256 sum of the converted bytes
+ *
+ * @return 1 = success, 0 = at least one character is not a hex digit
+ */
+    uint8_t ASCII_hex_2_bytes(uint8_t *D, const char *S, uint8_t N_bytes, uint8_t *LRC){
+
+        const uint8_t *P = (const uint8_t *) S;
+        uint8_t invalid = 0;
+        uint8_t sum = 0;
+        uint8_t hi;
+        uint8_t lo;
+        uint8_t b;
+
+        while (N_bytes--){
+            hi = hex_nibble(P[0]);
+            lo = hex_nibble(P[1]);
+            P += 2;
+            invalid |= hi | lo;
+            b = (hi << 4) | lo;
+            *D++ = b;                                               // D may trail P in the same buffer - b is not read back
+            sum += b;
+        }
+        *LRC = sum;
+        return !(invalid & HEX_INVALID);
+    }
+
+
+
+
+
+
+
+
+
+ /**
+  * @brief Determine if a valid MODBUS message has been received.  The message is converted to
+  * bytes once, here, and MODBUS_get_Nth_word and MODBUS_get_Nth_int read the bytes.  The original
+  * characters are left in the USART circular buffer for MODBUS_slave_echo.  The previous message
+  * is released from the USART buffer on the next call to this function.
+  *
+  * A message that is not properly formed or whose LRC (ASCII) or CRC (RTU) does not match is
+  * dropped before it reaches the sketch.  It is counted.  See MODBUS_get_stats.
+  *
+  * @return 0 = no new message, 1 = a valid message had been retrieved
+  */
+    uint8_t MODBUS_slave_is_new_msg(void){
+
+        uint8_t valid;
+
+        if (MODBUS_line_held){
+            USART_release_line();
+            MODBUS_line_held = 0;
+        }
+
+        if (!USART_peek_line(&MODBUS_line))
+            return 0x00;
+
+        MODBUS_line_held = 1;
+        num_char = MODBUS_line.len_1 + MODBUS_line.len_2;
+
+        if (MODBUS_mode == MODBUS_RTU)
+            valid = decode_RTU_line();
+        else
+            valid = decode_ASCII_line();
+
+        if (!valid){
+            USART_release_line();
+            MODBUS_line_held = 0;
+            return 0x00;
+        }
+
+        return 0x01;
+
+    }
+
+
+
+
+
+
+/**
+ * @brief Convert the held ASCII message (less the ':' and the CR) to bytes in MODBUS_frame and
+ * check its LRC.  The LRC is summed as the bytes are converted.  A message that does not wrap in
+ * the circular buffer is converted directly from the buffer.
+ *
+ * A message without the ':', with an odd number of hex digits, or without the CR before the LF is
+ * counted as invalid.  Only a well formed message with a bad LRC is counted as a checksum error.
+ *
+ * @return 1 = success, 0 = not a MODBUS ASCII message or the LRC is bad
+ */
+    static uint8_t decode_ASCII_line(void){
+
+        uint8_t N_bytes;
+        uint8_t invalid = 0;
+        uint8_t LRC = 0;
+        uint8_t hi;
+        uint8_t lo;
+
+        N_bytes = (num_char - 2) >> 1;
+
+        if ((num_char < 4) || (num_char & 0x01) || (N_bytes > MODBUS_FRAME_LEN) ||
+            (USART_line_char(&MODBUS_line, 0) != ':') || (USART_line_char(&MODBUS_line, num_char - 1) != 0x0D)){
+            MODBUS_stats.invalid++;                                 // ':', pairs of hex digits, and CR
+            return 0x00;
+        }
+
+        if (MODBUS_line.len_1 > (N_bytes << 1)){
+            invalid = !ASCII_hex_2_bytes(MODBUS_frame, MODBUS_line.seg_1 + 1, N_bytes, &LRC);
+        }
+        else{
+            for (uint8_t i = 0; i < N_bytes; i++){
+                hi = hex_nibble(USART_line_char(&MODBUS_line, (i << 1) + 1));
+                lo = hex_nibble(USART_line_char(&MODBUS_line, (i << 1) + 2));
+                invalid |= hi | lo;
+                MODBUS_frame[i] = (hi << 4) | lo;
+                LRC += MODBUS_frame[i];
+            }
+            invalid &= HEX_INVALID;
+        }
+
+        if (invalid){
+            MODBUS_stats.invalid++;
+            return 0x00;
+        }
+        if (LRC != 0){                                              // the sum of a good frame including its LRC is 0
+            MODBUS_stats.checksum++;
+            return 0x00;
+        }
+        MODBUS_frame_len = N_bytes - 1;
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Copy the held RTU frame to MODBUS_frame and check its CRC in the same pass.
+ *
+ * @return 1 = success, 0 = the frame is too short, too long, or the CRC is bad
+ */
+    static uint8_t decode_RTU_line(void){
+
+        uint16_t CRC = 0xFFFF;                                      // the CRC of a good frame including its CRC is 0
+        uint8_t c;
+
+        if ((num_char < 4) || (num_char > MODBUS_FRAME_LEN)){
+            MODBUS_stats.invalid++;
+            return 0x00;
+        }
+
+        for (uint8_t i = 0; i < num_char; i++){
+            c = USART_line_char(&MODBUS_line, i);
+            MODBUS_frame[i] = c;
+            CRC = CRC_update(CRC, c);
+        }
+        if (CRC != 0){
+            MODBUS_stats.checksum++;
+            return 0x00;
+        }
+        MODBUS_frame_len = num_char - 2;
+        return 0x01;
+    }
 
 
 
@@ -417,22 +1551,21 @@
  * @note Note the CR character is already contained in the received string since the LF was used as
  * the terminating character.
  *
- * @note For debug purposes the complete MODBUS_cmd_line is available.  This function could be 
- * improved by removing this feature.
+ * @note The echo is copied from the receive circular buffer to the transmit circular buffer and
+ * the function returns.  The bus is released by the transmit complete ISR.  In RTU mode the
+ * received CRC is sent back unchanged.
  */
 
     void MODBUS_slave_echo(void){
 
-        char term_str[] = {0x0A, 0x00};                         // end with CR (already on string) LF, NULL
-
-        strncpy(MODBUS_cmd_line, MODBUS_str, size_of_cmd_lines);    
-        strncat (MODBUS_cmd_line, term_str, size_of_cmd_lines);
+        char term_str[] = {0x0A};                               // end with CR (already on string) LF
 
-        digitalWrite(RS_485_dir_pin, BUS_WRITE);
-        delayMicroseconds(1000);
-        USART_puts(MODBUS_cmd_line);
-        delayMicroseconds(1500);
-        digitalWrite(RS_485_dir_pin, BUS_READ);
+        bus_take();
+        USART_nb_write(MODBUS_line.seg_1, MODBUS_line.len_1);
+        USART_nb_write(MODBUS_line.seg_2, MODBUS_line.len_2);
+        if (MODBUS_mode != MODBUS_RTU){                         // an RTU frame ends with its CRC
+            USART_nb_write(term_str, 1);
+        }
 
     }
 
@@ -441,49 +1574,44 @@
 
 
 /**
- * @brief The incoming MODBUS string is held in a line buffer called MODBUS_str.  This function is
- * used to pull a single word (16-bit value) from the buffer.  Recall that the incoming string
- * consists of hexadecimal encoded ASCII characters.  This function combines 4 such characters.
+ * @brief Retrieve a single word (16-bit value) from the current message.  The message was
+ * converted to bytes by MODBUS_slave_is_new_msg so this is two array reads.
  *
- * @param N is a pointer to the starting position of the desired word.
+ * @param N is the position of the desired word in the ASCII message e.g., 5 for the starting
+ * address.  The same positions are used in RTU mode.  N is converted to the byte position
+ * (N - 1) / 2.
  *
  * @return the 16-bit value.  For example the specified data address and register data are 
  * encoded as 16-bit values.
  */
     uint16_t MODBUS_get_Nth_word(uint8_t N){
 
-        uint8_t d_3 = (ASCII_hex_2_bin(MODBUS_str[N    ]));
-        uint8_t d_2 = (ASCII_hex_2_bin(MODBUS_str[N + 1]));
-        uint8_t d_1 = (ASCII_hex_2_bin(MODBUS_str[N + 2]));
-        uint8_t d_0 = (ASCII_hex_2_bin(MODBUS_str[N + 3]));
-
-        uint16_t d;
+        uint8_t i = (N - 1) >> 1;
 
-        d = (d_3 << 4) + d_2;
-        d = d << 8;
-        d += (d_1 << 4) + d_0;
+        if (i + 1 >= MODBUS_FRAME_LEN)
+            return 0;
 
-        return d;
+        return (MODBUS_frame[i] << 8) + MODBUS_frame[i + 1];
 
     }
 
 
 /**
- * @brief The incoming MODBUS string is held in a line buffer called MODBUS_str.  This function is
- * used to pull a single integer (8-bit value) from the buffer.  Recall that the incoming string
- * consists of hexadecimal encoded ASCII characters.  This function combines 2 such characters.
+ * @brief Retrieve a single integer (8-bit value) from the current message.
  *
- * @param N is a pointer to the starting position of the desired integer.
+ * @param N is the position of the desired integer in the ASCII message.  See MODBUS_get_Nth_word.
  *
  * @return the 8-bit value.  For example, the second field in a MODBUS string is a 8-bit 
  * slave address.
  */
     uint8_t MODBUS_get_Nth_int(uint8_t N){
 
-        uint8_t d_1 = (ASCII_hex_2_bin(MODBUS_str[N    ]));
-        uint8_t d_0 = (ASCII_hex_2_bin(MODBUS_str[N + 1]));
+        uint8_t i = (N - 1) >> 1;
 
-        return (d_1 << 4) + d_0;
+        if (i >= MODBUS_FRAME_LEN)
+            return 0;
+
+        return MODBUS_frame[i];
 
     }
 
@@ -497,11 +1625,11 @@ uint16_t regs[N_REGS];
 /**
  * @brief This function is involved is assembling an outgoing MODBUS frame.  When this function is
  * called the values to be sent have already been collected into the buffer regs.  This function
- * prepends the slave address, MODBUS function code, and number of bytes to be sent.  It them calls
- * the pack_ASCII_str function which completes the frame assembly by prepending the ':' symbol
- * and appending the LRC and CR/LF pair.
+ * sends the slave address, MODBUS function code, and number of bytes followed by the words.  The
+ * frame is encoded as it is queued for the USART: the ':' symbol, the hex digits, and the LRC and
+ * CR/LF pair in ASCII mode or the bytes and the CRC in RTU mode.
  *
- * @param N number of words (16-bit) to be included in the frame.  
+ * @param N number of words (16-bit) to be included in the frame, at most N_REGS
  *
  * @param slave_addr The address of the sending slave
  *
@@ -510,26 +1638,16 @@ uint16_t regs[N_REGS];
 
     void MODBUS_put_N_words(uint8_t N, uint8_t slave_addr){
 
-        uint8_t cmd_str_hex[40] = { slave_addr, READ_HOLDING_REGISTERS, N * 2 } ;            //FIXME Test tomorrow - this may have been the error
-
-        uint8_t i;
-
-        for(i = 0; i < N; i++){                             // take 16-bit words stored in regs and split into 8-bit
-
-            cmd_str_hex[(i * 2) + 3] = regs[i] >> 8;
-            cmd_str_hex[(i * 2) + 4] = regs[i] & 0x00FF;
+        reply_begin();
+        reply_byte(slave_addr);
+        reply_byte(READ_HOLDING_REGISTERS);
+        reply_byte(N << 1);
 
+        for(uint8_t i = 0; i < N; i++){                     // take 16-bit words stored in regs and split into 8-bit
+            reply_byte(regs[i] >> 8);
+            reply_byte(regs[i] & 0x00FF);
         }
-
-        pack_ASCII_str(MODBUS_cmd_line, cmd_str_hex, 3 + (N * 2));
-
-    // Write the word
-
-        digitalWrite(RS_485_dir_pin, BUS_WRITE);
-        delayMicroseconds(1700);
-        USART_puts(MODBUS_cmd_line);
-        delayMicroseconds(1500);
-        digitalWrite(RS_485_dir_pin, BUS_READ);
+        reply_end();                                        // the bus is released by the transmit complete ISR
     }
 
 
@@ -560,3 +1678,567 @@ uint16_t regs[N_REGS];
 
         regs[index] = D;
     }
+
+
+
+/*******************************************************************************
+ *  Slave register map
+ ******************************************************************************/
+
+
+/**
+ * @brief Serve registers from a table instead of hand written switch statements.  Each entry binds
+ * a block of consecutive register addresses to an array in RAM or to get and set functions.  The
+ * table must be sorted by address and the blocks must not overlap.  The table is searched with a
+ * binary search so a longer map does not slow the lookup noticeably.
+ *
+ * \b Example:
+ *    @code
+ *          uint16_t setpoints[8];
+ *
+ *          uint16_t read_temperature(uint16_t addr){ return ADC_temperature(); }
+ *
+ *          const MODBUS_range_t register_map[] = {
+ *          //    first   count  data        get               set  flags
+ *              { 0x0000,   1,   0,          read_temperature, 0,   MODBUS_READ_ONLY },
+ *              { 0x0100,   8,   setpoints,  0,                0,   0 }
+ *          };
+ *
+ *          void setup(){
+ *              MODBUS_init(RS_485_DIR_PIN, USART_TIMEOUT);
+ *              MODBUS_slave_map(MY_ADDR, register_map, sizeof(register_map) / sizeof(register_map[0]));
+ *          }
+ *
+ *          void loop(){
+ *              MODBUS_slave_service();
+ *          }
+ *    @endcode
+ *
+ * A read is answered MODBUS_READ_AHEAD registers at a time.  Their values are taken from the map,
+ * then encoded and queued for the USART.  A slow get function, e.g., one that reads an ADC, delays
+ * the start of the reply rather than pausing it part way.  The next block is read while the
+ * transmit buffer drains.  Keep each block of get calls shorter than the time to send the transmit
+ * buffer.
+ *
+ * Blocks flagged MODBUS_CACHE_REPLY promise that their registers change only through MODBUS
+ * writes.  A read of such registers is encoded once and the reply is kept.  The same read is then
+ * answered by copying the reply to the USART.  A write to a register discards the replies that
+ * hold it.  When the sketch changes such a register itself it must call MODBUS_slave_invalidate.
+ * Up to MODBUS_REPLY_CACHE replies of at most MODBUS_REPLY_CACHE_LEN characters are kept.
+ *
+ * The requests for other stations are discarded by the USART receive ISR as soon as their address
+ * arrives (see USART_set_filter).  They take no room in the receive buffer and no time in
+ * MODBUS_slave_service.  Call after MODBUS_init or MODBUS_INIT_RTU.
+ *
+ * @param slave_addr the address of this station.  Writes to address 0 (broadcast) are also
+ *        carried out but are not answered.
+ *
+ * @param map the table.  It is used in place and must remain valid.
+ *
+ * @return 1 = success, 0 = the table is not sorted or the blocks overlap (see ERROR_MSG)
+ */
+    uint8_t MODBUS_slave_map(uint8_t slave_addr, const MODBUS_range_t *map, uint8_t N_ranges){
+
+        for (uint8_t i = 0; i < N_ranges; i++){
+            if ((map[i].count == 0) || ((uint32_t) map[i].first + map[i].count > 0x10000UL) ||
+                ((i > 0) && ((uint32_t) map[i - 1].first + map[i - 1].count > map[i].first))){
+                strncpy(ERROR_MSG, "MODBUS_slave_map: blocks unsorted or overlapping", SIZE_ERROR_MSG);
+                return 0x00;
+            }
+        }
+
+        slave_address = slave_addr;
+        slave_map = map;
+        slave_map_N = N_ranges;
+        MODBUS_slave_invalidate();
+
+        if (MODBUS_mode == MODBUS_RTU){                             // the address is the first byte of the frame
+            char own[1] = {(char) slave_addr};
+            char all[1] = {MODBUS_BROADCAST_ADDR};
+
+            USART_set_filter(own, all, 1);
+        }
+        else{
+            char own[3] = {':', digit[slave_addr >> 4], digit[slave_addr & 0x0F]};
+            char all[3] = {':', '0', '0'};
+
+            USART_set_filter(own, all, 3);
+        }
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Serve the next request from the map set by MODBUS_slave_map.  Read holding registers
+ * (0x03), preset single register (0x06), and preset multiple registers (0x10) are implemented.
+ * Requests that cannot be carried out are answered with a MODBUS exception:
+ *
+ *      0x01    the function code is not implemented
+ *      0x02    a register is not in the map or a write was made to a read-only register
+ *      0x03    the number of registers is out of range or a set function refused the value
+ *
+ * @return 1 = a request for this station was served, 0 = nothing to do
+ */
+    uint8_t MODBUS_slave_service(void){
+
+        uint8_t addr;
+
+        if (!MODBUS_slave_is_new_msg()){
+            return 0x00;
+        }
+
+        addr = MODBUS_frame[0];
+        if ((addr != slave_address) && (addr != MODBUS_BROADCAST_ADDR)){
+            return 0x00;
+        }
+
+        switch (MODBUS_frame[1]){
+
+            case READ_HOLDING_REGISTERS:
+                if (addr != MODBUS_BROADCAST_ADDR){                 // a broadcast read has no meaning
+                    service_read();
+                }
+                break;
+
+            case PRESET_SINGLE_REGISTER:
+                service_write_single();
+                break;
+
+            case PRESET_MULTIPLE_REGISTERS:
+                service_write_multiple();
+                break;
+
+            default:
+                reply_exception(MODBUS_ILLEGAL_FUNCTION);
+        }
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Discard every kept reply.  Call after the sketch changes a register of a block flagged
+ * MODBUS_CACHE_REPLY.
+ */
+    void MODBUS_slave_invalidate(void){
+
+        for (uint8_t i = 0; i < MODBUS_REPLY_CACHE; i++){
+            reply_cache[i].len = 0;
+        }
+    }
+
+
+
+/**
+ * @brief Find the block holding addr.  With N > 1 the registers addr through addr + N - 1 must all
+ * be mapped.  They may span blocks that follow one another without a gap.
+ *
+ * @param write 1 = every register must be writable
+ *
+ * @return the block holding addr, 0 = at least one register is not mapped (or not writable)
+ */
+    static const MODBUS_range_t *map_find(uint16_t addr, uint16_t N, uint8_t write){
+
+        uint8_t lo = 0;
+        uint8_t hi = slave_map_N;
+        uint8_t mid;
+        const MODBUS_range_t *first = 0;
+        const MODBUS_range_t *R;
+        uint32_t end = (uint32_t) addr + N;                         // one past the last register
+        uint32_t next;
+
+        while (lo < hi){
+            mid = (lo + hi) >> 1;
+            if (addr < slave_map[mid].first){
+                hi = mid;
+            }
+            else if ((uint16_t) (addr - slave_map[mid].first) >= slave_map[mid].count){
+                lo = mid + 1;
+            }
+            else{
+                first = &slave_map[mid];
+                break;
+            }
+        }
+        if (!first){
+            return 0;
+        }
+
+        for (R = first; ; R++){
+            if (write && ((R->flags & MODBUS_READ_ONLY) || (!R->data && !R->set))){
+                return 0;
+            }
+            next = (uint32_t) R->first + R->count;
+            if (next >= end){
+                return first;
+            }
+            if ((R + 1 >= slave_map + slave_map_N) || (R[1].first != next)){
+                return 0;                                           // a gap in the map
+            }
+        }
+    }
+
+
+
+/**
+ * @brief Read holding registers (0x03).  The reply is encoded as the registers are read, or
+ * copied when it has been kept (see MODBUS_CACHE_REPLY).
+ */
+    static void service_read(void){
+
+        uint16_t addr = (MODBUS_frame[2] << 8) + MODBUS_frame[3];
+        uint16_t N = (MODBUS_frame[4] << 8) + MODBUS_frame[5];
+        const MODBUS_range_t *R;
+        uint8_t slave;
+        uint8_t block;
+
+        if (MODBUS_frame_len != 6){
+            MODBUS_stats.invalid++;
+            return;
+        }
+        if ((N == 0) || (N > MODBUS_MAX_READ_WORDS)){
+            reply_exception(MODBUS_ILLEGAL_DATA_VALUE);
+            return;
+        }
+        if (!(R = map_find(addr, N, 0))){
+            reply_exception(MODBUS_ILLEGAL_DATA_ADDRESS);
+            return;
+        }
+        if (reply_cached(R, addr, N)){
+            return;
+        }
+
+        slave = MODBUS_frame[0];
+        block = map_read(R, addr, N);                               // before the bus is taken
+        reply_begin();
+        reply_byte(slave);
+        reply_byte(READ_HOLDING_REGISTERS);
+        reply_byte(N << 1);
+
+        for ( ; ; ){
+            for (uint8_t i = 0; i < block; i++){
+                reply_byte(read_ahead[i] >> 8);
+                reply_byte(read_ahead[i] & 0x00FF);
+            }
+            addr += block;
+            N -= block;
+            if (!N){
+                break;
+            }
+            while ((uint16_t) (addr - R->first) >= R->count){
+                R++;                                                // map_find checked that it follows
+            }
+            block = map_read(R, addr, N);                           // while the last block is sent
+        }
+        reply_end();
+    }
+
+
+
+/**
+ * @brief Read up to MODBUS_READ_AHEAD registers from the map into read_ahead.  A reply is encoded
+ * from values read ahead a block at a time.  The get functions then run while the previous block
+ * is on the wire, not between the characters of the reply.  In RTU a pause there would end the
+ * frame.
+ *
+ * @return the number of registers read
+ */
+    static uint8_t map_read(const MODBUS_range_t *R, uint16_t addr, uint16_t N){
+
+        uint8_t block = (N < MODBUS_READ_AHEAD) ? N : MODBUS_READ_AHEAD;
+
+        for (uint8_t i = 0; i < block; i++, addr++){
+            if ((uint16_t) (addr - R->first) >= R->count){
+                R++;                                                // map_find checked that it follows
+            }
+            if (R->data)
+                read_ahead[i] = R->data[addr - R->first];
+            else if (R->get)
+                read_ahead[i] = R->get(addr);
+            else
+                read_ahead[i] = 0;
+        }
+        return block;
+    }
+
+
+
+/**
+ * @brief Store one value in the map.
+ *
+ * @return 1 = success, 0 = the set function refused the value
+ */
+    static uint8_t map_write(const MODBUS_range_t *R, uint16_t addr, uint16_t value){
+
+        if (R->set && !R->set(addr, value)){
+            return 0x00;
+        }
+        if (R->data){
+            R->data[addr - R->first] = value;
+        }
+        reply_invalidate(addr);
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Preset single register (0x06).  The reply is an echo of the request.
+ */
+    static void service_write_single(void){
+
+        uint16_t addr = (MODBUS_frame[2] << 8) + MODBUS_frame[3];
+        uint16_t value = (MODBUS_frame[4] << 8) + MODBUS_frame[5];
+        const MODBUS_range_t *R;
+
+        if (MODBUS_frame_len != 6){
+            MODBUS_stats.invalid++;
+            return;
+        }
+        if (!(R = map_find(addr, 1, 1))){
+            reply_exception(MODBUS_ILLEGAL_DATA_ADDRESS);
+            return;
+        }
+        if (!map_write(R, addr, value)){
+            reply_exception(MODBUS_ILLEGAL_DATA_VALUE);
+            return;
+        }
+        if (MODBUS_frame[0] != MODBUS_BROADCAST_ADDR){
+            MODBUS_slave_echo();
+        }
+    }
+
+
+
+/**
+ * @brief Preset multiple registers (0x10).  Every register is checked before any is written.  A
+ * set function that refuses a value stops the writes that follow it.
+ *
+ *      address, 0x10, starting address (2), number of registers (2), byte count, data ...
+ *
+ * The reply repeats the address, function, starting address, and number of registers.
+ */
+    static void service_write_multiple(void){
+
+        uint16_t addr = (MODBUS_frame[2] << 8) + MODBUS_frame[3];
+        uint16_t N = (MODBUS_frame[4] << 8) + MODBUS_frame[5];
+        const MODBUS_range_t *R;
+        uint8_t *data = MODBUS_frame + 7;
+
+        if ((MODBUS_frame_len < 7) || (MODBUS_frame_len != 7 + MODBUS_frame[6])){
+            MODBUS_stats.invalid++;
+            return;
+        }
+        if ((N == 0) || (N > MODBUS_MAX_WRITE_WORDS) || (MODBUS_frame[6] != (N << 1))){
+            reply_exception(MODBUS_ILLEGAL_DATA_VALUE);
+            return;
+        }
+        if (!(R = map_find(addr, N, 1))){
+            reply_exception(MODBUS_ILLEGAL_DATA_ADDRESS);
+            return;
+        }
+
+        for (uint16_t i = 0; i < N; i++){
+            if ((uint16_t) (addr + i - R->first) >= R->count){
+                R++;
+            }
+            if (!map_write(R, addr + i, (data[0] << 8) + data[1])){
+                reply_exception(MODBUS_ILLEGAL_DATA_VALUE);
+                return;
+            }
+            data += 2;
+        }
+
+        if (MODBUS_frame[0] != MODBUS_BROADCAST_ADDR){
+            reply_begin();
+            for (uint8_t i = 0; i < 6; i++){
+                reply_byte(MODBUS_frame[i]);
+            }
+            reply_end();
+        }
+    }
+
+
+
+/**
+ * @brief Answer with an exception: the function code with its high bit set followed by the
+ * exception code.  Broadcasts are never answered.
+ */
+    static void reply_exception(uint8_t code){
+
+        if (MODBUS_frame[0] == MODBUS_BROADCAST_ADDR){
+            return;
+        }
+        reply_begin();
+        reply_byte(MODBUS_frame[0]);
+        reply_byte(MODBUS_frame[1] | 0x80);
+        reply_byte(code);
+        reply_end();
+    }
+
+
+
+/**
+ * @brief Encode a reply while it is queued for the USART.  The characters are collected in
+ * reply_buf and handed to USART_nb_write a piece at a time.  The reply may be longer than the USART
+ * transmit buffer.  USART_nb_write then waits for room.
+ *
+ * The bus is held from here to reply_end.  The transmitter may run dry between two pieces, e.g.,
+ * while a get function of the map reads an ADC.  The transmit complete interrupt must not release
+ * the bus in that gap.
+ */
+    static void reply_begin(void){
+
+        bus_take();
+        bus_held = 1;
+        reply_N = 0;
+        reply_capture_N = 0;
+        reply_LRC = 0;
+        reply_CRC = 0xFFFF;
+        if (MODBUS_mode != MODBUS_RTU){
+            reply_buf[reply_N++] = ':';
+        }
+    }
+
+
+
+    static void reply_byte(uint8_t b){
+
+        if (reply_N > sizeof(reply_buf) - 2){
+            reply_send();
+        }
+
+        if (MODBUS_mode == MODBUS_RTU){
+            reply_CRC = CRC_update(reply_CRC, b);
+            reply_buf[reply_N++] = b;
+        }
+        else{
+            reply_LRC += b;
+            reply_buf[reply_N++] = digit[b >> 4];
+            reply_buf[reply_N++] = digit[b & 0x0F];
+        }
+    }
+
+
+
+    static void reply_end(void){
+
+        if (MODBUS_mode == MODBUS_RTU){
+            uint16_t CRC = reply_CRC;                               // reply_byte updates reply_CRC
+
+            reply_byte(CRC & 0x00FF);                               // low byte first
+            reply_byte(CRC >> 8);
+        }
+        else{
+            reply_byte(0 - reply_LRC);
+            if (reply_N > sizeof(reply_buf) - 2){
+                reply_send();
+            }
+            reply_buf[reply_N++] = 0x0D;
+            reply_buf[reply_N++] = 0x0A;
+        }
+        reply_send();
+
+        uint8_t sreg = SREG;                                        // the interrupt may come as bus_held is cleared
+
+        cli();
+        bus_held = 0;
+        if (USART_is_TX_idle()){                                    // it came while the bus was held
+            bus_release();
+        }
+        SREG = sreg;
+
+        if (reply_capture){
+            reply_capture->len = reply_capture_N;
+            reply_capture = 0;
+        }
+    }
+
+
+
+/**
+ * @brief Hand the encoded characters to the USART, keeping a copy when the reply is to be kept.
+ */
+    static void reply_send(void){
+
+        if (reply_capture){
+            if (reply_capture_N + reply_N <= MODBUS_REPLY_CACHE_LEN){
+                memcpy(reply_capture->frame + reply_capture_N, reply_buf, reply_N);
+                reply_capture_N += reply_N;
+            }
+            else{
+                reply_capture = 0;                                  // too long to keep
+            }
+        }
+        USART_nb_write(reply_buf, reply_N);
+        reply_N = 0;
+    }
+
+
+
+/**
+ * @brief Answer a read from a kept reply.  A read that may be kept but is not yet is marked to be
+ * kept as it is encoded.  It replaces an empty slot or else the next reply, in turn, that has not
+ * been sent since it was last passed over.  A master that polls more reads than there are slots
+ * then keeps the reads it repeats most.
+ *
+ * @param R the block holding addr, see map_find
+ *
+ * @return 1 = the reply was sent, 0 = it must be encoded
+ */
+    static uint8_t reply_cached(const MODBUS_range_t *R, uint16_t addr, uint16_t N){
+
+        uint32_t end = (uint32_t) addr + N;
+        uint16_t len = (MODBUS_mode == MODBUS_RTU) ? 5 + 2 * N : 11 + 4 * N;
+
+        reply_capture = 0;
+        if (len > MODBUS_REPLY_CACHE_LEN){
+            return 0x00;
+        }
+        for ( ; ; R++){                                             // map_find checked that the blocks follow
+            if (!(R->flags & MODBUS_CACHE_REPLY)){
+                return 0x00;
+            }
+            if ((uint32_t) R->first + R->count >= end){
+                break;
+            }
+        }
+
+        for (uint8_t i = 0; i < MODBUS_REPLY_CACHE; i++){
+            if (reply_cache[i].len && (reply_cache[i].addr == addr) && (reply_cache[i].N == N)){
+                reply_cache[i].used = 1;
+                bus_take();
+                USART_nb_write(reply_cache[i].frame, reply_cache[i].len);
+                return 0x01;
+            }
+        }
+
+        for (uint8_t i = 0; i < 2 * MODBUS_REPLY_CACHE; i++){      // every slot is passed over at most once
+            reply_capture = &reply_cache[reply_cache_next];
+            reply_cache_next = (reply_cache_next + 1) % MODBUS_REPLY_CACHE;
+            if (!reply_capture->len || !reply_capture->used){
+                break;
+            }
+            reply_capture->used = 0;
+        }
+        reply_capture->len = 0;
+        reply_capture->used = 0;
+        reply_capture->addr = addr;
+        reply_capture->N = N;
+        return 0x00;
+    }
+
+
+
+/**
+ * @brief Discard the kept replies that hold the register.
+ */
+    static void reply_invalidate(uint16_t addr){
+
+        for (uint8_t i = 0; i < MODBUS_REPLY_CACHE; i++){
+            if ((uint16_t) (addr - reply_cache[i].addr) < reply_cache[i].N){
+                reply_cache[i].len = 0;
+            }
+        }
+    }
@@ -5,9 +5,43 @@
 
 // Common
 
+    #include "USART_baud.h"
+
     void MODBUS_init(uint8_t dir_pin, uint16_t timeout);
+    void MODBUS_init_baud(uint8_t dir_pin, uint16_t timeout, uint16_t UBRR, uint8_t U2X);
+
+    #define MODBUS_INIT_BAUD(dir_pin, timeout, baud) \
+        MODBUS_init_baud((dir_pin), (timeout), USART_baud<F_CPU, (baud)>::UBRR, USART_baud<F_CPU, (baud)>::U2X)
+
+    uint8_t MODBUS_init_RTU(uint8_t dir_pin, uint16_t timeout, uint16_t UBRR, uint8_t U2X, uint16_t silence_us);
+
+    #define MODBUS_RTU_SILENCE_US(baud) \
+        (((baud) > 19200UL) ? 1750U : (uint16_t) (38500000UL / (baud)))  // 3.5 characters of 11 bits
+
+    #define MODBUS_INIT_RTU(dir_pin, timeout, baud) \
+        MODBUS_init_RTU((dir_pin), (timeout), USART_baud<F_CPU, (baud)>::UBRR, USART_baud<F_CPU, (baud)>::U2X, \
+                        MODBUS_RTU_SILENCE_US(baud))
+
+    #define MODBUS_ASCII                0x00
+    #define MODBUS_RTU                  0x01
+
+    typedef struct {                                                // dropped messages, see MODBUS_get_stats
+        uint16_t checksum;
+        uint16_t invalid;
+    } MODBUS_stats_t;
+
+    void MODBUS_get_stats(MODBUS_stats_t *S);
+    void MODBUS_reset_stats(void);
 
-    #define size_of_cmd_lines           40
+    #define MODBUS_GUARD_US             100                         // default RS-485 turnaround guard, see MODBUS_set_guard
+
+    void MODBUS_set_guard(uint16_t guard_us);
+
+    #define MODBUS_FRAME_LEN            64                          // longest message in bytes, including the LRC or CRC
+    #define MODBUS_MAX_PUT_WORDS        ((MODBUS_FRAME_LEN - 9) / 2)    // the longest 0x10 request, as MODBUS_MAX_WRITE_WORDS of a slave
+    #define size_of_cmd_lines           (20 + 4 * MODBUS_MAX_PUT_WORDS) // that request framed in ASCII with CR/LF and null
+
+    #define MODBUS_BROADCAST_ADDR       0x00                        // written by every slave, never answered
 
 // MASTER
 
@@ -21,14 +55,54 @@
     #define USART_TIMEOUT_MILLISECONDS  1000
 
     extern char MODBUS_cmd_line[size_of_cmd_lines];
-    extern char MODBUS_reply_line[size_of_cmd_lines];
 
     uint8_t MODBUS_put_word(uint8_t physical_addr, uint16_t mem_addr, uint16_t data);
     uint8_t MODBUS_read_registers(uint16_t *destination, uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t get_n_words );
 
-// SLAVE
+    uint8_t MODBUS_put_words(uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t n_words, const uint16_t *data);
+
+    #define MODBUS_IDLE                 0x00                        // MODBUS_poll results
+    #define MODBUS_BUSY                 0x01
+    #define MODBUS_DONE                 0x02
+    #define MODBUS_FAILED               0x03
+
+    uint8_t MODBUS_submit_read(uint16_t *destination, uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t get_n_words);
+    uint8_t MODBUS_submit_write(uint8_t physical_addr, uint16_t mem_addr, uint16_t data);
+    uint8_t MODBUS_submit_write_words(uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t n_words, const uint16_t *data);
+    uint8_t MODBUS_poll(void);
+
+    #define MODBUS_BROADCAST_DELAY_MS   20                          // quiet time after a broadcast, see MODBUS_set_broadcast_delay
 
-    // FIXME is would also be nice to have a put multiple words
+    void MODBUS_set_broadcast_delay(uint16_t delay_ms);
+
+    #ifndef MODBUS_LATENCY_SLAVES
+        #define MODBUS_LATENCY_SLAVES   4                           // slaves whose reply times are kept
+    #endif
+
+    #define MODBUS_LATENCY_BUCKETS      8
+    #define MODBUS_LATENCY_BUCKET_US    500                         // bucket i counts replies under 500 uS << i, the last the rest
+
+    typedef struct {                                                // reply times of one slave, see MODBUS_get_latency
+        uint8_t slave_addr;
+        uint16_t count;                                             // replies received
+        uint16_t failed;                                            // timeouts and bad replies
+        uint32_t min_us;                                            // end of the request to the end of the reply
+        uint32_t max_us;
+        uint32_t send_sum_us;                                       // start of the request to the end of its last character
+        uint32_t response_sum_us;                                   // end of the request to the first character of the reply
+        uint32_t reply_sum_us;                                      // first character of the reply to the end of the reply
+        uint16_t histogram[MODBUS_LATENCY_BUCKETS];                 // end of the request to the end of the reply
+        uint32_t smooth_us;                                         // moving average of the response, see MODBUS_set_adaptive_timeout
+        uint32_t deviation_us;                                      // moving average of its deviation from smooth_us
+    } MODBUS_latency_t;
+
+    uint8_t MODBUS_get_latency(uint8_t physical_addr, MODBUS_latency_t *L);
+    void MODBUS_reset_latency(void);
+
+    void MODBUS_set_adaptive_timeout(uint16_t floor_ms, uint16_t ceiling_ms);
+    uint16_t MODBUS_get_timeout(uint8_t physical_addr);
+
+// SLAVE
 
     #define MODBUS_STR_LENGTH       100
 
@@ -42,5 +116,38 @@
     void MODBUS_buffer_words(uint16_t index, uint16_t D);
     void MODBUS_put_N_words(uint8_t N, uint8_t slave_addr);
 
+    #define MODBUS_MAX_READ_WORDS   125                             // the reply is encoded as it is sent
+
+    #ifndef MODBUS_READ_AHEAD
+        #define MODBUS_READ_AHEAD   16                              // registers read from the map ahead of the reply, see MODBUS_slave_map
+    #endif
+    #define MODBUS_MAX_WRITE_WORDS  ((MODBUS_FRAME_LEN - 9) / 2)    // the longest 0x10 request that fits MODBUS_frame
+
+    #define MODBUS_ILLEGAL_FUNCTION     0x01                        // exception codes
+    #define MODBUS_ILLEGAL_DATA_ADDRESS 0x02
+    #define MODBUS_ILLEGAL_DATA_VALUE   0x03
+
+    #define MODBUS_READ_ONLY        0x01                            // MODBUS_range_t flags
+    #define MODBUS_CACHE_REPLY      0x02                            // changed only by MODBUS writes, see MODBUS_slave_invalidate
+
+    #ifndef MODBUS_REPLY_CACHE
+        #define MODBUS_REPLY_CACHE  2                               // encoded read replies kept, at least 1
+    #endif
+
+    #define MODBUS_REPLY_CACHE_LEN  48                              // the longest reply kept, 9 registers in ASCII
+
+    typedef struct {                                                // a block of registers, see MODBUS_slave_map
+        uint16_t first;                                             // address of the first register
+        uint16_t count;
+        uint16_t *data;                                             // the registers in RAM, or 0 to use get and set
+        uint16_t (*get)(uint16_t addr);
+        uint8_t (*set)(uint16_t addr, uint16_t value);              // return 0 to refuse the value
+        uint8_t flags;
+    } MODBUS_range_t;
+
+    uint8_t MODBUS_slave_map(uint8_t slave_addr, const MODBUS_range_t *map, uint8_t N_ranges);
+    uint8_t MODBUS_slave_service(void);
+    void MODBUS_slave_invalidate(void);
+
 #endif
 
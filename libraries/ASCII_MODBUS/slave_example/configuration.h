@@ -24,6 +24,8 @@
 
     #define RS_485_DIR_PIN              2
 
+//  #define MODBUS_RTU_MODE                                         // binary RTU frames at 19200 baud instead of ASCII
+
     #define USART_TIMEOUT               100
 
     #define read_registers              3
@@ -25,6 +25,12 @@
     #include "configuration.h"
     #include "error.h"
     #include "USART.h"
+
+    #ifdef MODBUS_RTU_MODE
+        #define USART_FRAME_TIMER                                   // RTU frames are separated by silence - uses Timer2
+    #endif
+
+    #include "USART_instance.h"                                     // the USART driver - include once, in the sketch only
     #include "ASCII_MODBUS.h"
 
 
@@ -37,17 +43,34 @@
 
     #endif
 
-    uint16_t addr;
-    uint16_t n;
-    uint16_t data;
-    uint16_t i;
-    uint16_t code;
+    uint16_t setpoints[16];                                         // written by the master at 0x0100
+
 
 // Function declarations
 
-    void service_read_holding_reg(void);
-    void service_preset_single_reg(void);
-    void service_preset_multiple_regs(void);
+    uint16_t count_up(uint16_t addr);
+
+
+/***************************************************************************************************
+ *  The register map.  The blocks are sorted by address and must not overlap.
+ *
+ *      0x0000          the test value 0xABCD
+ *      0x0001 - 0x007C the register address i.e., a read of n words at 0x0001 returns 1, 2, ... n
+ *      0x0100 - 0x010F setpoints, written with preset single (0x06) or preset multiple (0x10)
+ *
+ *  Reads (0x03) of up to 125 words may span blocks that follow one another without a gap.
+ *  None of the registers change except through MODBUS writes so every block is flagged
+ *  MODBUS_CACHE_REPLY.  A repeated short read is answered with the reply encoded the first time.
+ **************************************************************************************************/
+
+    static uint16_t test_value = 0xABCD;
+
+    const MODBUS_range_t register_map[] = {
+    //    first    count  data        get       set  flags
+        { 0x0000,    1,   &test_value, 0,        0,   MODBUS_READ_ONLY | MODBUS_CACHE_REPLY },
+        { 0x0001,  124,   0,           count_up, 0,   MODBUS_READ_ONLY | MODBUS_CACHE_REPLY },
+        { 0x0100,   16,   setpoints,   0,        0,   MODBUS_CACHE_REPLY }
+    };
 
 
 void setup(){
@@ -55,10 +78,20 @@ void setup(){
     #ifdef DEBUG
 
         BB_serial.begin(9600);
+
+    #endif
+
+    #ifdef MODBUS_RTU_MODE
+
+        MODBUS_INIT_RTU(RS_485_DIR_PIN, USART_TIMEOUT, 19200UL);
+
+    #else
+
         MODBUS_init(RS_485_DIR_PIN, USART_TIMEOUT);
 
     #endif
 
+    MODBUS_slave_map(MY_ADDR, register_map, sizeof(register_map) / sizeof(register_map[0]));
 }
 
 /***************************************************************************************************
@@ -71,17 +104,7 @@ void setup(){
  *
  **************************************************************************************************/
 
-ISR(USART_RX_vect){
-
- /**
- * @note This Interrupt Service Routine is called when a new character is received by the USART.
- * Ideally it would have been placed in the USART.cpp file but there is a error "multiple definition
- * of vector_18".  Apparently Arduino detects when an ISR is in the main sketch.  If you place it
- * somewhere else it is missed and replaced with the Arduino handler.  This is the source of the
- * multiple definitions error -  * see discussion @ http://forum.arduino.cc/index.php?topic=42153.0
- */
-    USART_handle_ISR();
-}
+// The USART interrupt service routines are defined by USART_instance.h
 
 /***************************************************************************************************
  *  ____            _____  _  __ _____  _____    ____   _    _  _   _  _____
@@ -96,245 +119,23 @@ ISR(USART_RX_vect){
 
 void loop(){
 
-    #ifdef DEBUG
-
-        static uint8_t waiting = 0;
-
-        if(!waiting){
-            snprintf(line, BB_serial_max_char, "Waiting for a MODBUS string\n");
-            BB_serial.print(line);
-            waiting = 1;
-        }
-
-    #endif
-
-    if(MODBUS_slave_is_new_msg()){
+    if(MODBUS_slave_service()){
 
         #ifdef DEBUG
 
-            snprintf(line, BB_serial_max_char, "New message received!\n");
+            snprintf(line, BB_serial_max_char, "served function code %x\n", MODBUS_get_Nth_int(3));
             BB_serial.print(line);
-            waiting = 0;
 
         #endif
-
-        #define MODBUS_SLAVE_ADDR           1       // Specify the starting positions for the various fields
-        #define MODBUS_FUNCTION             3
-
-        if(MODBUS_get_Nth_int(MODBUS_SLAVE_ADDR) == MY_ADDR){
-
-            code = MODBUS_get_Nth_int(MODBUS_FUNCTION);
-
-            #ifdef DEBUG
-
-                snprintf(line, BB_serial_max_char, "\t and its for me\n");
-                BB_serial.print(line);
-                snprintf(line, BB_serial_max_char, "\t function code = %x\n", code);
-                BB_serial.print(line);
-
-            #endif
-
-            switch(code){
-
-                case READ_HOLDING_REGISTERS:
-                    service_read_holding_reg();
-                    break;
-
-                case PRESET_SINGLE_REGISTER:
-                    service_preset_single_reg();
-                    break;
-
-                case PRESET_MULTIPLE_REGISTERS:
-                    service_preset_multiple_regs();
-                    break;
-
-                default:
-                    ;
-            }// end switch
-
-        }// end if (MODBUS_is_for_me()){
-    }// end if (MODBUS_retrieve_new_msg()){
-}// end loop(){
-
-
-
-
-/** ************************************************************************************************
- *
- *  MODBUS mode 3: read holding registers
- *
- *     ----------------------------------------------------
- *    | Master Frame Format                                |
- *    |----------------------------------------------------|
- *    | Name                     | Length (char) | Example |
- *    |--------------------------|---------------|---------|
- *    | Start                    |      1        |  :      |
- *    | Slave address            |      2        |  01     |
- *    | Function                 |      2        |  03     |
- *    | Starting register addr   |      4        |  019B   |
- *    | Number of words to read  |      4        |  0001   |
- *    | LRC                      |      2        |  FIXME  |
- *    | (CR/LF) pair             |      2        |         |
- *     ----------------------------------------------------
- *
- * @note This routine contains two predefined tests.
- *
- *  1) Reading address 0x0000 with N = 1 will return 0XAAAA
- *
- *  2) Reading address 0x0001 will a request for n words returns the requested n words.  The words
- *     contains sequential integers starting with 1.
- */
-
-    #define MODE_3_START_DATA_ADDR      5
-    #define MODE_3_NUM_WORDS_TO_READ    9
-
-void service_read_holding_reg(void){
-
-    addr = MODBUS_get_Nth_word(MODE_3_START_DATA_ADDR);
-    n = MODBUS_get_Nth_word(MODE_3_NUM_WORDS_TO_READ);
-
-    #ifdef DEBUG
-
-        snprintf(line, BB_serial_max_char, "\t starting addr = %x\n", addr);
-        BB_serial.print(line);
-        snprintf(line, BB_serial_max_char, "\t num regs to read = %x\n", n);
-        BB_serial.print(line);
-
-    #endif
-
-    switch(addr){
-
-        case 0x0000:                                                // hardcode a test case: reads from address 0 return "AAAA"
-
-            MODBUS_buffer_words(0, 0xABCD);
-            MODBUS_put_N_words(1, MY_ADDR);
-
-            break;
-
-        case 0x0001:                                                // another test case: reads from address 1 return N words counting up from 1
-
-            for(i = 0; i < n; i++){
-                MODBUS_buffer_words(i, i + 1);
-            }
-            MODBUS_put_N_words(n, MY_ADDR);
-
-            break;
-
-
-
-        // TODO insert your cases here
-
-
-
-        default:
-            ;
- 
-    }// end switch
-}
-
-/** ************************************************************************************************
- *
- *  MODBUS mode 6: Preset a single register
- *
- *     ----------------------------------------------------
- *    | Master Frame Format                                |
- *    |----------------------------------------------------|
- *    | Name                     | Length (char) | Example |
- *    |--------------------------|---------------|---------|
- *    | Start                    |      1        |  :      |
- *    | Slave address            |      2        |  01     |
- *    | Function                 |      2        |  06     |
- *    | Register address         |      4        |  019B   |
- *    | Preset data              |      4        |  0001   |
- *    | LRC                      |      2        |  FIXME  |
- *    | (CR/LF) pair             |      2        |         |
- *     ----------------------------------------------------
- *
- */
-
-    #define MODE_6_STARTING_ADDR        5
-    #define MODE_6_FIRST_DATA           9
-
-void service_preset_single_reg(void){
-
-    addr = MODBUS_get_Nth_word(MODE_6_STARTING_ADDR);
-    data = MODBUS_get_Nth_word(MODE_6_FIRST_DATA);
-
-    #ifdef DEBUG
-
-        snprintf(line, BB_serial_max_char, "\t starting addr = %x\n", addr);
-        BB_serial.print(line);
-        snprintf(line, BB_serial_max_char, "\t data = %x\n", data);
-        BB_serial.print(line);
-
-    #endif
-
-    //FIXME insert your setter here
-
-    MODBUS_slave_echo( );                                     // when writing a single register simple echo the original string
-    
-    #ifdef DEBUG
-
-        snprintf(line, BB_serial_max_char, "%s", MODBUS_cmd_line);
-        BB_serial.print(line);
-
-    #endif
-
+    }
 }
 
 
 
-/** ************************************************************************************************
- *
- *  MODBUS mode 16: Preset a multiple register
- *
- *     ----------------------------------------------------
- *    | Master Frame Format                                |
- *    |----------------------------------------------------|
- *    | Name                     | Length (char) | Example |
- *    |--------------------------|---------------|---------|
- *    | Start                    |      1        |  :      |
- *    | Slave address            |      2        |  01     |
- *    | Function                 |      2        |  16     |
- *    | Starting address         |      4        |  019B   |
- *    | Num registers            |      2        |  0001   |
- *    | Data                     |      N        |  N      |
- *    | LRC                      |      2        |  FIXME  |
- *    | (CR/LF) pair             |      2        |         |
- *     ----------------------------------------------------
- *
+/**
+ * @brief Reads from 0x0001 through 0x007C return the register address.
  */
+uint16_t count_up(uint16_t addr){
 
-    #define MODE_16_STARTING_ADDR        5
-    #define MODE_16_BYTE_COUNT           9
-    #define MODE_16_FIRST_DATA           11
-
-void service_preset_multiple_regs(void){
-
-    //TODO develop these function when you have time
-
-    addr = MODBUS_get_Nth_word(MODE_6_STARTING_ADDR);
-    n = MODBUS_get_Nth_int(MODE_16_BYTE_COUNT);
-
-
-    switch(addr){
-
-        case 0x0000:                        // typical
-
-            for(i = 0; i < n; i++){
-
-                data = MODBUS_get_Nth_word(MODE_6_FIRST_DATA + i);
-
-                //FIXME Insert your setter here
-
-                //MODBUS_buffer_words(i, i + 1);    // TODO need to make the return string
-            }
-            //MODBUS_put_N_words(n, MY_ADDR);
-
-        break;
-
-        default:
-            ;
-
-    }// end switch
+    return addr;
 }
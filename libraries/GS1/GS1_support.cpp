@@ -26,7 +26,7 @@
  * responding to MODBUS commands.
  *
  */
-    uint8_t GS1_init(uint8_t slave_addr, uint8_t dir_pin, uint8_t timeout){
+    uint8_t GS1_init(uint8_t slave_addr, uint8_t dir_pin, uint16_t timeout){
 
         MODBUS_init(dir_pin, timeout);
         return MODBUS_put_word(slave_addr, Serial_Comm_RUN_Command, 0x0000);
@@ -58,6 +58,30 @@
 
 
 
+/**
+ * @brief Set the speed and activate a particular GS1 motor drive in a single transaction.  The
+ * speed reference and the run command are adjacent registers so both are written with one preset
+ * multiple registers request.
+ *
+ * @param slave_addr a byte identifying a particular GS1 device.  Note this
+ *        must be manually programmed into the GS1.
+ *
+ * @param deci_freq the motor synchronous speed in tenths of a Hz, see GS1_set_speed
+ *
+ * @return result of operation, 1 = success, 0 = failure
+ *
+ */
+    uint8_t GS1_run_at_speed(uint8_t slave_addr, uint16_t deci_freq){
+
+        uint16_t data[2] = { deci_freq, 0x0001 };                   // Serial_Comm_Speed_Reference, Serial_Comm_RUN_Command
+
+        return MODBUS_put_words(slave_addr, Serial_Comm_Speed_Reference, 2, data);
+
+    }
+
+
+
+
 /**
  * @brief Simplified function to activate a particular GS1 motor drive.
  *
@@ -90,3 +114,77 @@
         return MODBUS_put_word(slave_addr, Serial_Comm_RUN_Command, 0x0000);
 
     }
+
+
+
+
+/**
+ * @brief Set the speed of every GS1 drive on the bus with a single broadcast.  See GS1_set_speed.
+ *
+ * @return result of operation, 1 = the request was sent, 0 = failure
+ *
+ */
+    uint8_t GS1_all_set_speed(uint16_t deci_freq){
+
+        return GS1_set_speed(MODBUS_BROADCAST_ADDR, deci_freq);
+
+    }
+
+
+
+
+/**
+ * @brief Set the speed and activate every GS1 drive on the bus with a single broadcast.  Each
+ * drive acts on the same frame so they start together, where addressing them one at a time would
+ * start each a round trip after the one before.
+ *
+ * \b Example:
+ *    @code
+ *          GS1_all_run_at_speed(400);                              // the whole line at 40 Hz
+ *          ...
+ *          GS1_all_turn_off();
+ *    @endcode
+ *
+ * @param deci_freq the motor synchronous speed in tenths of a Hz, see GS1_set_speed
+ *
+ * @return result of operation, 1 = the request was sent, 0 = failure
+ *
+ * @note No drive replies to a broadcast so success does not mean that every drive received it.
+ *       Read back the status of each drive when that matters.
+ *
+ */
+    uint8_t GS1_all_run_at_speed(uint16_t deci_freq){
+
+        return GS1_run_at_speed(MODBUS_BROADCAST_ADDR, deci_freq);
+
+    }
+
+
+
+
+/**
+ * @brief Activate every GS1 drive on the bus with a single broadcast.  See GS1_all_run_at_speed.
+ *
+ * @return result of operation, 1 = the request was sent, 0 = failure
+ *
+ */
+    uint8_t GS1_all_turn_on(void){
+
+        return GS1_turn_on(MODBUS_BROADCAST_ADDR);
+
+    }
+
+
+
+
+/**
+ * @brief Secure every GS1 drive on the bus with a single broadcast.  See GS1_all_run_at_speed.
+ *
+ * @return result of operation, 1 = the request was sent, 0 = failure
+ *
+ */
+    uint8_t GS1_all_turn_off(void){
+
+        return GS1_turn_off(MODBUS_BROADCAST_ADDR);
+
+    }
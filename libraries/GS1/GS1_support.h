@@ -25,12 +25,24 @@
     #define Serial_Comm_Speed_Reference     0x091A
     #define Serial_Comm_RUN_Command         0x091B
 
-    uint8_t GS1_init(uint8_t slave_address, uint8_t dir_pin, uint8_t timeout);
+    uint8_t GS1_init(uint8_t slave_address, uint8_t dir_pin, uint16_t timeout);
 
     uint8_t GS1_set_speed(uint8_t slave_addr, uint16_t deci_freq);
 
+    uint8_t GS1_run_at_speed(uint8_t slave_addr, uint16_t deci_freq);
+
     uint8_t GS1_turn_on(uint8_t slave_addr);
 
     uint8_t GS1_turn_off(uint8_t slave_addr);
 
+// Every drive on the bus at once, see GS1_all_run_at_speed
+
+    uint8_t GS1_all_set_speed(uint16_t deci_freq);
+
+    uint8_t GS1_all_run_at_speed(uint16_t deci_freq);
+
+    uint8_t GS1_all_turn_on(void);
+
+    uint8_t GS1_all_turn_off(void);
+
 #endif
@@ -0,0 +1,64 @@
+/**
+ * @file GS1_cache.cpp
+ *
+ * @brief Read the parameters of a GS1 drive through the MODBUS register cache.  Kept apart from
+ * GS1_support so that sketches which do not use the cache do not depend on MODBUS_cache.
+ */
+
+    #include <stdint.h>
+    #include <Arduino.h>
+
+    #include "ASCII_MODBUS.h"
+    #include "GS1_support.h"
+    #include "MODBUS_cache.h"
+    #include "GS1_cache.h"
+
+
+
+/**
+ * @brief Keep the motor and ramp parameters of a GS1 drive in the register cache.  They change only
+ * when the drive is programmed, so reading them need not use the bus each time.  The first
+ * GS1_get_parameter of a group reads the whole group in one request.
+ *
+ * @param slave_addr a byte identifying a particular GS1 device.  Note this
+ *        must be manually programmed into the GS1.
+ *
+ * @param ttl_ms the age at which a parameter is read again, MODBUS_CACHE_FOREVER = never
+ *
+ * @return result of operation, 1 = success, 0 = failure
+ *
+ */
+    uint8_t GS1_cache_parameters(uint8_t slave_addr, uint16_t ttl_ms){
+
+        return MODBUS_cache_set_ttl(slave_addr, mtr_name_volts, mtr_max_rpm - mtr_name_volts + 1, ttl_ms) &&
+               MODBUS_cache_set_ttl(slave_addr, stop_method, deceleration_time_1 - stop_method + 1, ttl_ms);
+
+    }
+
+
+
+
+/**
+ * @brief Read a parameter of a GS1 drive through the register cache.
+ *
+ * \b Example:
+ *    @code
+ *          uint16_t volts;
+ *
+ *          GS1_cache_parameters(GS1_ADDR, MODBUS_CACHE_FOREVER);
+ *          ...
+ *          if (GS1_get_parameter(GS1_ADDR, mtr_name_volts, &volts)){
+ *              // use volts
+ *          }
+ *    @endcode
+ *
+ * @param param the address of the parameter e.g., mtr_base_rpm
+ *
+ * @return result of operation, 1 = success, 0 = failure
+ *
+ */
+    uint8_t GS1_get_parameter(uint8_t slave_addr, uint16_t param, uint16_t *value){
+
+        return MODBUS_cache_read(value, slave_addr, param, 1);
+
+    }
@@ -0,0 +1,16 @@
+#ifndef _GS1_CACHE
+
+    #define _GS1_CACHE
+
+    #include <stdint.h>
+
+    #include "GS1_support.h"
+    #include "MODBUS_cache.h"
+
+// Parameters read through the register cache, see GS1_cache_parameters
+
+    uint8_t GS1_cache_parameters(uint8_t slave_addr, uint16_t ttl_ms);
+
+    uint8_t GS1_get_parameter(uint8_t slave_addr, uint16_t param, uint16_t *value);
+
+#endif
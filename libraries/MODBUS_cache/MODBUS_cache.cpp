@@ -0,0 +1,588 @@
+/**
+ * @file MODBUS_cache.cpp
+ *
+ * @brief Hold a copy of slave registers in the master and write them behind the application.
+ * MODBUS_cache_write changes the copy at once and marks the register dirty.  Nothing is waited for.
+ * MODBUS_cache_service, called from loop(), writes the dirty registers whenever the bus is free:
+ *
+ *      latest      only the value a register holds when its request is framed is sent.  The values
+ *                  written while the bus was busy are never sent.
+ *      unchanged   writing the value the slave already holds marks nothing dirty.  It is known to
+ *                  hold it while the register waits to be sent, or is being sent, and for the time
+ *                  to live of its range after it was read or written.  Otherwise it is sent again
+ *                  since the slave may have changed it.
+ *      adjacent    dirty registers of a slave at consecutive addresses go in one preset multiple
+ *                  registers request, up to MODBUS_MAX_PUT_WORDS.  A clean register between two
+ *                  dirty ones is sent again rather than splitting the request, but only while the
+ *                  slave is known to hold its value (see unchanged).  Otherwise the request ends
+ *                  at the last dirty register before it.
+ *
+ * The registers are kept in order of slave and address.  A request that fails leaves its registers
+ * dirty so they are sent again.
+ *
+ * The cache also reads through.  MODBUS_cache_read takes a register from the cache while its value
+ * is younger than the time to live given to its address range with MODBUS_cache_set_ttl.  The
+ * registers it must read from the slave are read with a single request from the first to the last.
+ * When they lie in a range with a time to live, the request is widened over the stale registers
+ * next to them in that range.  Reading one motor parameter then loads its neighbours as well.  A
+ * register written with MODBUS_cache_write is read back from the cache until the slave holds it.
+ *
+ * \b Example:
+ *    @code
+ *          void loop(){
+ *
+ *              MODBUS_cache_service();
+ *
+ *              if (ramp_step_due()){
+ *                  MODBUS_cache_write(GS1_ADDR, Serial_Comm_Speed_Reference, deci_freq++);
+ *              }
+ *
+ *              // other work e.g., the ADC and the LCD
+ *          }
+ *    @endcode
+ *
+ *    @code
+ *          void setup(){
+ *              MODBUS_init(RS_485_DIR_PIN, 20);
+ *              MODBUS_cache_set_ttl(GS1_ADDR, mtr_name_volts, 5, MODBUS_CACHE_FOREVER);
+ *          }
+ *
+ *          uint16_t rated_rpm(void){
+ *
+ *              uint16_t rpm = 0;
+ *
+ *              MODBUS_cache_read(&rpm, GS1_ADDR, mtr_base_rpm, 1);    // the bus is used the first time only
+ *              return rpm;
+ *          }
+ *    @endcode
+ *
+ * @note Do not call the other MODBUS master functions or the scheduler while registers are
+ *       pending.  Call MODBUS_cache_flush first.  MODBUS_cache_read may be called at any time.  It
+ *       waits for the write in progress.
+ */
+
+    #include <stdint.h>
+    #include <string.h>
+    #include <Arduino.h>
+
+    #include "ASCII_MODBUS.h"
+    #include "MODBUS_cache.h"
+    #include "error.h"
+
+
+    #define CACHE_VALID         0x01                                // the value is known
+    #define CACHE_DIRTY         0x02                                // the slave does not hold the value yet
+    #define CACHE_SENDING       0x04                                // the register is in the request in progress
+
+    typedef struct {
+        uint8_t slave_addr;
+        uint8_t flags;
+        uint16_t addr;
+        uint16_t value;
+        unsigned long stamp;                                        // mS, when the value was read or written
+    } entry_t;
+
+    typedef struct {                                                // see MODBUS_cache_set_ttl
+        uint8_t slave_addr;
+        uint16_t first;
+        uint16_t count;
+        uint16_t ttl_ms;                                            // 0 = free
+    } ttl_t;
+
+
+// Private functions
+
+    static entry_t *entry_get(uint8_t slave_addr, uint16_t addr);
+    static uint8_t entry_find(uint8_t slave_addr, uint16_t addr, uint8_t *i);
+    static uint8_t entry_fresh(uint8_t slave_addr, uint16_t addr, uint16_t *value);
+    static const ttl_t *ttl_range(uint8_t slave_addr, uint16_t addr);
+    static uint8_t cache_start(void);
+    static void cache_finish(uint8_t result);
+    static void cache_wait(void);
+
+
+// Private variables
+
+    static entry_t entries[MODBUS_CACHE_REGS];
+    static ttl_t ttls[MODBUS_CACHE_TTL_RANGES];
+    static uint8_t N_entries = 0;
+    static uint8_t in_flight = 0;                                   // a request of the cache is in progress
+    static MODBUS_cache_stats_t stats;
+
+
+
+/**
+ * @brief Forget every register and time to live, and clear the statistics.  Registers not yet
+ * written are lost.
+ */
+    void MODBUS_cache_init(void){
+
+        memset(entries, 0, sizeof(entries));
+        memset(ttls, 0, sizeof(ttls));
+        memset(&stats, 0, sizeof(stats));
+        N_entries = 0;
+        in_flight = 0;
+    }
+
+
+
+/**
+ * @brief Write a register without waiting.  The value is sent by MODBUS_cache_service.
+ *
+ * @return 1 = success, 0 = every register held by the cache is waiting to be sent (see ERROR_MSG)
+ */
+    uint8_t MODBUS_cache_write(uint8_t physical_addr, uint16_t mem_addr, uint16_t data){
+
+        entry_t *E = entry_get(physical_addr, mem_addr);
+        uint16_t value;
+
+        if (!E){
+            return 0x00;
+        }
+        stats.writes++;
+
+        if (entry_fresh(physical_addr, mem_addr, &value) && (value == data)){    // on its way, or known to be held
+            return 0x01;
+        }
+        E->value = data;
+        E->flags |= CACHE_VALID | CACHE_DIRTY;
+        E->stamp = millis();
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Advance the request in progress and, when the bus is free, send the next dirty registers.
+ * Call from loop() as often as possible.  Nothing is waited for.  After a failed request the next
+ * is not started until the following call.
+ *
+ * @return 1 = a request is in progress, 0 = the bus is idle
+ */
+    uint8_t MODBUS_cache_service(void){
+
+        uint8_t result = MODBUS_poll();
+
+        if (result == MODBUS_BUSY){
+            return 0x01;
+        }
+
+        if (in_flight){
+            cache_finish(result);
+            if (result != MODBUS_DONE){
+                return 0x00;
+            }
+        }
+        return cache_start();
+    }
+
+
+
+/**
+ * @brief Send every dirty register.  The function blocks until they are sent or a request fails.
+ *
+ * @return 1 = success, 0 = failure (see ERROR_MSG).  The registers that were not written remain
+ *         dirty.
+ */
+    uint8_t MODBUS_cache_flush(void){
+
+        uint16_t failed = stats.failed;
+
+        while (MODBUS_cache_service());
+
+        return (stats.failed == failed) && !MODBUS_cache_pending();
+    }
+
+
+
+/**
+ * @return the number of registers not yet written to their slaves
+ */
+    uint8_t MODBUS_cache_pending(void){
+
+        uint8_t n = 0;
+
+        for (uint8_t i = 0; i < N_entries; i++){
+            if (entries[i].flags & (CACHE_DIRTY | CACHE_SENDING)){
+                n++;
+            }
+        }
+        return n;
+    }
+
+
+
+/**
+ * @brief Give the registers first through first + count - 1 of a slave a time to live.  Their
+ * values are kept by MODBUS_cache_read and used until they are ttl_ms old.  Registers outside every
+ * range are always read from the slave.  Setting the range again with the same first register
+ * changes its time to live.  A ttl_ms of 0 removes it.
+ *
+ * @param ttl_ms the age in mS at which a value is read again, MODBUS_CACHE_FOREVER = never e.g.,
+ *        the motor name plate parameters of the GS1
+ *
+ * @return 1 = success, 0 = MODBUS_CACHE_TTL_RANGES are in use (see ERROR_MSG)
+ */
+    uint8_t MODBUS_cache_set_ttl(uint8_t physical_addr, uint16_t first, uint16_t count, uint16_t ttl_ms){
+
+        ttl_t *free_range = 0;
+
+        for (uint8_t r = 0; r < MODBUS_CACHE_TTL_RANGES; r++){
+            if (ttls[r].ttl_ms && (ttls[r].slave_addr == physical_addr) && (ttls[r].first == first)){
+                free_range = &ttls[r];
+                break;
+            }
+            if (!ttls[r].ttl_ms && !free_range){
+                free_range = &ttls[r];
+            }
+        }
+
+        if (!free_range){
+            strncpy(ERROR_MSG, "MODBUS_cache_set_ttl: no free range", SIZE_ERROR_MSG);
+            return 0x00;
+        }
+        free_range->slave_addr = physical_addr;
+        free_range->first = first;
+        free_range->count = count;
+        free_range->ttl_ms = count ? ttl_ms : 0;
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Read registers, from the cache where it holds them and from the slave for the rest.  The
+ * function blocks until the registers are read.  See MODBUS_read_registers.
+ *
+ * @param get_n_words 1 through MODBUS_MAX_READ_WORDS.  The registers read from the slave are kept
+ *        only where they have a time to live, see MODBUS_cache_set_ttl.
+ *
+ * @return 1 = success, 0 = failure (see ERROR_MSG).  On failure destination may hold part of the
+ *         registers.
+ */
+    uint8_t MODBUS_cache_read(uint16_t *destination, uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t get_n_words){
+
+        uint16_t words[MODBUS_CACHE_REGS];
+        uint16_t *D;
+        uint16_t lo = 0;                                            // the registers to read from the slave
+        uint16_t hi = 0;
+        uint16_t addr;
+        uint16_t stale;
+        uint8_t i;
+        uint8_t missed = 0;
+        const ttl_t *R;
+        entry_t *E;
+        unsigned long now;
+
+        if ((get_n_words == 0) || (get_n_words > MODBUS_MAX_READ_WORDS)){
+            strncpy(ERROR_MSG, "MODBUS_cache_read: number of words out of range", SIZE_ERROR_MSG);
+            return 0x00;
+        }
+
+        for (uint16_t j = 0; j < get_n_words; j++){
+            if (entry_fresh(physical_addr, starting_mem_addr + j, &destination[j])){
+                stats.hits++;
+                continue;
+            }
+            stats.misses++;
+            if (!missed){
+                lo = starting_mem_addr + j;
+                missed = 1;
+            }
+            hi = starting_mem_addr + j;
+        }
+        if (!missed){
+            return 0x01;
+        }
+
+        R = ttl_range(physical_addr, lo);
+        if (R && (hi - R->first < R->count)){                      // widen over the stale neighbours
+            while ((lo > R->first) && (hi - lo + 1 < MODBUS_CACHE_REGS) && !entry_fresh(physical_addr, lo - 1, &stale)){
+                lo--;
+            }
+            while ((hi - R->first + 1 < R->count) && (hi - lo + 1 < MODBUS_CACHE_REGS) && !entry_fresh(physical_addr, hi + 1, &stale)){
+                hi++;
+            }
+        }
+
+        if ((lo < starting_mem_addr) || (hi >= starting_mem_addr + get_n_words))
+            D = words;                                              // no more than MODBUS_CACHE_REGS
+        else
+            D = destination + (lo - starting_mem_addr);
+
+        cache_wait();
+        stats.reads++;
+        if (!MODBUS_read_registers(D, physical_addr, lo, hi - lo + 1)){
+            return 0x00;
+        }
+
+        now = millis();
+        for (uint16_t j = 0; j <= hi - lo; j++){
+
+            addr = lo + j;
+            if (ttl_range(physical_addr, addr))
+                E = entry_get(physical_addr, addr);
+            else
+                E = entry_find(physical_addr, addr, &i) ? &entries[i] : 0;
+
+            if (E && !(E->flags & (CACHE_DIRTY | CACHE_SENDING))){
+                E->value = D[j];
+                E->flags |= CACHE_VALID;
+                E->stamp = now;
+            }
+
+            if ((addr >= starting_mem_addr) && (addr - starting_mem_addr < get_n_words)){
+                destination[addr - starting_mem_addr] = E ? E->value : D[j];   // a write not yet sent wins
+            }
+        }
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Forget the values of registers first through first + count - 1 of a slave so that the
+ * next MODBUS_cache_read takes them from the slave.  Registers not yet written are kept.
+ */
+    void MODBUS_cache_invalidate(uint8_t physical_addr, uint16_t first, uint16_t count){
+
+        for (uint8_t i = 0; i < N_entries; i++){
+            if ((entries[i].slave_addr == physical_addr) && ((uint16_t) (entries[i].addr - first) < count) &&
+                !(entries[i].flags & (CACHE_DIRTY | CACHE_SENDING))){
+                entries[i].flags &= ~CACHE_VALID;
+            }
+        }
+    }
+
+
+
+/**
+ * @brief Copy the counts since MODBUS_cache_init.  writes - registers is the number of bus writes
+ * saved.
+ */
+    void MODBUS_cache_get_stats(MODBUS_cache_stats_t *S){
+
+        *S = stats;
+    }
+
+
+
+/**
+ * @brief Find a register, or add it in order.  When the cache is full the oldest register that is
+ * not waiting to be sent is given up.
+ *
+ * @return the register, 0 = none is free (see ERROR_MSG)
+ */
+    static entry_t *entry_get(uint8_t slave_addr, uint16_t addr){
+
+        uint8_t i;
+        uint8_t j;
+
+        if (entry_find(slave_addr, addr, &i)){
+            return &entries[i];
+        }
+
+        if (N_entries == MODBUS_CACHE_REGS){
+            j = N_entries;
+            for (uint8_t k = 0; k < N_entries; k++){
+                if (!(entries[k].flags & (CACHE_DIRTY | CACHE_SENDING)) &&
+                    ((j == N_entries) || ((long) (entries[k].stamp - entries[j].stamp) < 0))){
+                    j = k;
+                }
+            }
+            if (j == N_entries){
+                strncpy(ERROR_MSG, "MODBUS_cache: no free register", SIZE_ERROR_MSG);
+                return 0;
+            }
+            memmove(&entries[j], &entries[j + 1], (N_entries - j - 1) * sizeof(entry_t));
+            N_entries--;
+            if (j < i){
+                i--;
+            }
+        }
+
+        memmove(&entries[i + 1], &entries[i], (N_entries - i) * sizeof(entry_t));
+        N_entries++;
+        entries[i].slave_addr = slave_addr;
+        entries[i].addr = addr;
+        entries[i].flags = 0;
+        entries[i].value = 0;
+        entries[i].stamp = millis();
+        return &entries[i];
+    }
+
+
+
+/**
+ * @brief Binary search of the registers in order of slave and address.
+ *
+ * @param i receives the register, or where it would be inserted
+ *
+ * @return 1 = found, 0 = not held
+ */
+    static uint8_t entry_find(uint8_t slave_addr, uint16_t addr, uint8_t *i){
+
+        uint32_t key = ((uint32_t) slave_addr << 16) | addr;
+        uint32_t k;
+        uint8_t low = 0;
+        uint8_t high = N_entries;
+        uint8_t mid;
+
+        while (low < high){
+            mid = (low + high) >> 1;
+            k = ((uint32_t) entries[mid].slave_addr << 16) | entries[mid].addr;
+            if (k == key){
+                *i = mid;
+                return 0x01;
+            }
+            if (k < key)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+        *i = low;
+        return 0x00;
+    }
+
+
+
+/**
+ * @brief A register may be taken from the cache when it holds a write not yet sent, or a value
+ * younger than the time to live of its range.
+ *
+ * @return 1 = value holds the register, 0 = it must be read from the slave
+ */
+    static uint8_t entry_fresh(uint8_t slave_addr, uint16_t addr, uint16_t *value){
+
+        uint8_t i;
+        const ttl_t *R;
+
+        if (!entry_find(slave_addr, addr, &i) || !(entries[i].flags & CACHE_VALID)){
+            return 0x00;
+        }
+
+        if (!(entries[i].flags & (CACHE_DIRTY | CACHE_SENDING))){
+            R = ttl_range(slave_addr, addr);
+            if (!R || ((R->ttl_ms != MODBUS_CACHE_FOREVER) && (millis() - entries[i].stamp >= R->ttl_ms))){
+                return 0x00;
+            }
+        }
+        *value = entries[i].value;
+        return 0x01;
+    }
+
+
+
+/**
+ * @return the range that holds the register, 0 = none
+ */
+    static const ttl_t *ttl_range(uint8_t slave_addr, uint16_t addr){
+
+        for (uint8_t r = 0; r < MODBUS_CACHE_TTL_RANGES; r++){
+            if (ttls[r].ttl_ms && (ttls[r].slave_addr == slave_addr) && ((uint16_t) (addr - ttls[r].first) < ttls[r].count)){
+                return &ttls[r];
+            }
+        }
+        return 0;
+    }
+
+
+
+/**
+ * @brief Send the first dirty register together with the dirty registers that follow it at
+ * consecutive addresses of the same slave.
+ *
+ * @return 1 = a request was started, 0 = nothing is dirty
+ */
+    static uint8_t cache_start(void){
+
+        uint16_t data[MODBUS_MAX_PUT_WORDS];
+        uint16_t value;
+        uint8_t first;
+        uint8_t last;
+        uint8_t n;
+        uint8_t started;
+
+        for (first = 0; first < N_entries; first++){
+            if (entries[first].flags & CACHE_DIRTY){
+                break;
+            }
+        }
+        if (first == N_entries){
+            return 0x00;
+        }
+
+        last = first;
+        for (uint8_t j = first + 1; (j < N_entries) && (j - first < MODBUS_MAX_PUT_WORDS); j++){
+            if ((entries[j].slave_addr != entries[first].slave_addr) || (entries[j].addr != entries[j - 1].addr + 1)){
+                break;
+            }
+            if (!(entries[j].flags & CACHE_DIRTY) && !entry_fresh(entries[j].slave_addr, entries[j].addr, &value)){
+                break;                                              // the slave may no longer hold it
+            }
+            if (entries[j].flags & CACHE_DIRTY){
+                last = j;
+            }
+        }
+        n = last - first + 1;
+
+        for (uint8_t j = 0; j < n; j++){
+            data[j] = entries[first + j].value;
+            entries[first + j].flags = (entries[first + j].flags & ~CACHE_DIRTY) | CACHE_SENDING;
+        }
+
+        if (n == 1)
+            started = MODBUS_submit_write(entries[first].slave_addr, entries[first].addr, data[0]);
+        else
+            started = MODBUS_submit_write_words(entries[first].slave_addr, entries[first].addr, n, data);
+
+        if (!started){                                              // another transaction holds the bus
+            cache_finish(MODBUS_FAILED);
+            return 0x00;
+        }
+        stats.frames++;
+        stats.registers += n;
+        in_flight = 1;
+        return 0x01;
+    }
+
+
+
+/**
+ * @brief Release the registers of the request.  Those written again while it was in progress are
+ * already dirty.  After a failure they all are.
+ */
+    static void cache_finish(uint8_t result){
+
+        in_flight = 0;
+        if (result != MODBUS_DONE){
+            stats.failed++;
+        }
+
+        for (uint8_t i = 0; i < N_entries; i++){
+            if (!(entries[i].flags & CACHE_SENDING)){
+                continue;
+            }
+            entries[i].flags &= ~CACHE_SENDING;
+            if (result != MODBUS_DONE){
+                entries[i].flags |= CACHE_DIRTY;
+            }
+        }
+    }
+
+
+
+/**
+ * @brief Let the write in progress end so that the bus is free for a read.
+ */
+    static void cache_wait(void){
+
+        uint8_t result;
+
+        if (!in_flight){
+            return;
+        }
+        while ((result = MODBUS_poll()) == MODBUS_BUSY);
+
+        cache_finish(result);
+    }
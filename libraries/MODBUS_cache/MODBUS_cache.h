@@ -0,0 +1,43 @@
+#ifndef _MODBUS_CACHE
+
+    #define _MODBUS_CACHE
+
+    #include <stdint.h>
+
+    #include "ASCII_MODBUS.h"
+
+    #ifndef MODBUS_CACHE_REGS
+        #define MODBUS_CACHE_REGS       16                          // registers held, all slaves together
+    #endif
+
+    #ifndef MODBUS_CACHE_TTL_RANGES
+        #define MODBUS_CACHE_TTL_RANGES 4                           // see MODBUS_cache_set_ttl
+    #endif
+
+    #define MODBUS_CACHE_FOREVER        0xFFFF                      // MODBUS_cache_set_ttl: read once, then never again
+
+    typedef struct {                                                // see MODBUS_cache_get_stats
+        uint16_t writes;                                            // calls to MODBUS_cache_write
+        uint16_t registers;                                         // registers sent to the slaves
+        uint16_t frames;                                            // requests sent
+        uint16_t failed;                                            // requests that failed, their registers are sent again
+        uint16_t hits;                                              // registers MODBUS_cache_read took from the cache
+        uint16_t misses;                                            // registers it had to read from the slave
+        uint16_t reads;                                             // read holding registers requests it sent
+    } MODBUS_cache_stats_t;
+
+    void MODBUS_cache_init(void);
+
+    uint8_t MODBUS_cache_write(uint8_t physical_addr, uint16_t mem_addr, uint16_t data);
+
+    uint8_t MODBUS_cache_service(void);
+    uint8_t MODBUS_cache_flush(void);
+    uint8_t MODBUS_cache_pending(void);
+
+    uint8_t MODBUS_cache_set_ttl(uint8_t physical_addr, uint16_t first, uint16_t count, uint16_t ttl_ms);
+    uint8_t MODBUS_cache_read(uint16_t *destination, uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t get_n_words);
+    void MODBUS_cache_invalidate(uint8_t physical_addr, uint16_t first, uint16_t count);
+
+    void MODBUS_cache_get_stats(MODBUS_cache_stats_t *S);
+
+#endif
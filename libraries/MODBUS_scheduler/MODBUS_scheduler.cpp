@@ -0,0 +1,415 @@
+/**
+ * @file MODBUS_scheduler.cpp
+ *
+ * @brief Share one RS-485 bus between several slaves.  The master holds a table of jobs:
+ *
+ *      poll        read registers from a slave every period, or back to back when the period is 0
+ *      write       write one or more registers once, then free the job
+ *
+ * MODBUS_sched_service is called from loop().  It advances the transaction in progress with
+ * MODBUS_poll and, in the same call that sees the transaction end, starts the next one.  The bus
+ * is therefore never left idle while a job is ready.
+ *
+ * The next job is the ready job with the highest priority (0 is the highest).  Jobs of equal
+ * priority go in order of their deadlines.  A job without a deadline (period or deadline 0) goes
+ * after every ready job of its priority that has one, and before its equals that became ready
+ * after it.  A poll must complete before its next period starts and
+ * a write within the deadline it was given.  Every deadline missed is counted, see
+ * MODBUS_sched_get_stats.  A poll that falls a period or more behind is not run once for each
+ * period it missed.  It is run once and starts a new period.
+ *
+ * \b Example:
+ *    @code
+ *          uint16_t status[2];
+ *          uint16_t speed;
+ *          int8_t status_job;
+ *
+ *          void setup(){
+ *              MODBUS_init(RS_485_DIR_PIN, 20);
+ *              status_job = MODBUS_sched_poll(status, 1, 0x2100, 2, 100, 0);   // every 100 mS, highest priority
+ *              MODBUS_sched_poll(&speed, 2, 0x2103, 1, 0, 5);                   // as often as the bus allows
+ *          }
+ *
+ *          void loop(){
+ *
+ *              MODBUS_sched_service();
+ *
+ *              if (MODBUS_sched_is_fresh(status_job)){
+ *                  // use status
+ *              }
+ *
+ *              if (start_button()){
+ *                  MODBUS_sched_write(1, Serial_Comm_RUN_Command, 0x0001, 50, 0);
+ *              }
+ *          }
+ *    @endcode
+ *
+ * @note Do not call the blocking MODBUS master functions or MODBUS_poll while jobs are scheduled.
+ */
+
+    #include <stdint.h>
+    #include <string.h>
+    #include <Arduino.h>
+
+    #include "ASCII_MODBUS.h"
+    #include "MODBUS_scheduler.h"
+    #include "error.h"
+
+
+    typedef struct {
+        uint8_t function;                                           // MODBUS function code, 0 = free
+        uint8_t priority;
+        uint8_t slave_addr;
+        uint8_t fresh;                                              // see MODBUS_sched_is_fresh
+        uint8_t cancelled;                                          // the slot is freed when its transaction ends
+        uint16_t addr;
+        uint16_t n_words;
+        uint16_t *destination;                                      // polls
+        uint16_t data[MODBUS_SCHED_PUT_WORDS];                      // writes
+        uint16_t window;                                            // period of a poll or deadline of a write in mS, 0 = none
+        unsigned long release;                                      // mS, the job is ready from this time
+        unsigned long deadline;                                     // mS, the release time when window = 0
+        MODBUS_sched_stats_t stats;
+    } job_t;
+
+    static_assert(MODBUS_SCHED_PUT_WORDS <= MODBUS_MAX_PUT_WORDS, "MODBUS_SCHED_PUT_WORDS exceeds MODBUS_MAX_PUT_WORDS");
+
+
+// Private functions
+
+    static int8_t job_add(uint8_t function, uint8_t slave_addr, uint16_t addr, uint16_t window, uint8_t priority);
+    static int8_t job_select(unsigned long now);
+    static uint8_t job_before(const job_t *A, const job_t *B);
+    static uint8_t job_start(int8_t j);
+    static void job_finish(int8_t j, uint8_t result, unsigned long now);
+
+
+// Private variables
+
+    static job_t jobs[MODBUS_SCHED_JOBS];
+    static int8_t running = -1;                                     // the job of the transaction in progress
+    static MODBUS_sched_stats_t totals;
+
+
+
+/**
+ * @brief Remove all jobs and clear the statistics.
+ */
+    void MODBUS_sched_init(void){
+
+        memset(jobs, 0, sizeof(jobs));
+        memset(&totals, 0, sizeof(totals));
+        running = -1;
+    }
+
+
+
+/**
+ * @brief Read registers from a slave periodically.
+ *
+ * @param destination receives the registers.  It must remain valid until the job is cancelled.
+ *
+ * @param period_ms the time between reads.  0 = read again as soon as the bus is free, with no
+ *        deadline.
+ *
+ * @param priority 0 is the highest
+ *
+ * @return the job, -1 = no free job (see ERROR_MSG)
+ */
+    int8_t MODBUS_sched_poll(uint16_t *destination, uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t get_n_words,
+                             uint16_t period_ms, uint8_t priority){
+
+        int8_t j = job_add(READ_HOLDING_REGISTERS, physical_addr, starting_mem_addr, period_ms, priority);
+
+        if (j >= 0){
+            jobs[j].destination = destination;
+            jobs[j].n_words = get_n_words;
+        }
+        return j;
+    }
+
+
+
+/**
+ * @brief Write a single register once.  The job is freed when the write completes or fails.
+ *
+ * @param deadline_ms the time from now within which the write should complete, 0 = none.  A late
+ *        write is still sent.  It is counted as missed.
+ *
+ * @return the job, -1 = no free job (see ERROR_MSG)
+ */
+    int8_t MODBUS_sched_write(uint8_t physical_addr, uint16_t mem_addr, uint16_t data, uint16_t deadline_ms, uint8_t priority){
+
+        int8_t j = job_add(PRESET_SINGLE_REGISTER, physical_addr, mem_addr, deadline_ms, priority);
+
+        if (j >= 0){
+            jobs[j].data[0] = data;
+            jobs[j].n_words = 1;
+        }
+        return j;
+    }
+
+
+
+/**
+ * @brief Write contiguous registers once.  See MODBUS_sched_write.  The data is copied.  It need
+ * not remain valid.  Every job holds room for MODBUS_SCHED_PUT_WORDS registers.  It may be raised
+ * as far as MODBUS_MAX_PUT_WORDS at the cost of 2 bytes of RAM per job for each register.
+ *
+ * @return the job, -1 = no free job or n_words is out of range (see ERROR_MSG)
+ */
+    int8_t MODBUS_sched_write_words(uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t n_words, const uint16_t *data,
+                                    uint16_t deadline_ms, uint8_t priority){
+
+        int8_t j;
+
+        if ((n_words == 0) || (n_words > MODBUS_SCHED_PUT_WORDS)){
+            strncpy(ERROR_MSG, "MODBUS_sched_write_words: number of words out of range", SIZE_ERROR_MSG);
+            return -1;
+        }
+
+        j = job_add(PRESET_MULTIPLE_REGISTERS, physical_addr, starting_mem_addr, deadline_ms, priority);
+        if (j >= 0){
+            memcpy(jobs[j].data, data, n_words * sizeof(uint16_t));
+            jobs[j].n_words = n_words;
+        }
+        return j;
+    }
+
+
+
+/**
+ * @brief Remove a job.  A read already in progress for the job still completes into its
+ * destination.  The job is not reused, nor counted, until that transaction has ended.
+ */
+    void MODBUS_sched_cancel(int8_t job){
+
+        if ((job < 0) || (job >= MODBUS_SCHED_JOBS)){
+            return;
+        }
+        if (job == running)
+            jobs[job].cancelled = 1;
+        else
+            jobs[job].function = 0;
+    }
+
+
+
+/**
+ * @brief Advance the transaction in progress and start the next job when it ends.  Call from
+ * loop() as often as possible.  Nothing is waited for.
+ *
+ * @return 1 = a transaction is in progress, 0 = the bus is idle
+ */
+    uint8_t MODBUS_sched_service(void){
+
+        uint8_t result = MODBUS_poll();
+        unsigned long now;
+        int8_t j;
+
+        if (result == MODBUS_BUSY){
+            return 0x01;
+        }
+
+        now = millis();
+        if ((running >= 0) && (result != MODBUS_IDLE)){
+            job_finish(running, result, now);
+        }
+        running = -1;
+
+        if ((j = job_select(now)) < 0){
+            return 0x00;
+        }
+        if (!job_start(j)){
+            job_finish(j, MODBUS_FAILED, now);
+            return 0x00;
+        }
+        running = j;
+        return 0x01;
+    }
+
+
+
+/**
+ * @return 1 = the poll has read new data since the last call, 0 = no new data
+ */
+    uint8_t MODBUS_sched_is_fresh(int8_t job){
+
+        uint8_t fresh;
+
+        if ((job < 0) || (job >= MODBUS_SCHED_JOBS)){
+            return 0x00;
+        }
+        fresh = jobs[job].fresh;
+        jobs[job].fresh = 0;
+        return fresh;
+    }
+
+
+
+/**
+ * @brief Copy the counts of completed, failed, and late transactions.
+ *
+ * @param job a poll job, or MODBUS_SCHED_TOTAL for all jobs including the writes that have been
+ *        freed
+ */
+    void MODBUS_sched_get_stats(int8_t job, MODBUS_sched_stats_t *S){
+
+        if ((job >= 0) && (job < MODBUS_SCHED_JOBS))
+            *S = jobs[job].stats;
+        else
+            *S = totals;
+    }
+
+
+
+/**
+ * @brief Take a free job.  It is ready at once.
+ */
+    static int8_t job_add(uint8_t function, uint8_t slave_addr, uint16_t addr, uint16_t window, uint8_t priority){
+
+        job_t *J;
+
+        for (int8_t j = 0; j < MODBUS_SCHED_JOBS; j++){
+
+            J = &jobs[j];
+            if (J->function){
+                continue;
+            }
+            memset(J, 0, sizeof(job_t));
+            J->function = function;
+            J->slave_addr = slave_addr;
+            J->addr = addr;
+            J->window = window;
+            J->priority = priority;
+            J->release = millis();
+            J->deadline = J->release + window;
+            return j;
+        }
+
+        strncpy(ERROR_MSG, "MODBUS_sched: no free job", SIZE_ERROR_MSG);
+        return -1;
+    }
+
+
+
+/**
+ * @brief Find the ready job with the highest priority and, among those, the earliest deadline.
+ * Polls whose deadline has passed before they could start are counted as missed and move on to
+ * the current period.
+ *
+ * @return the job, -1 = none is ready
+ */
+    static int8_t job_select(unsigned long now){
+
+        int8_t best = -1;
+        job_t *J;
+        unsigned long behind;
+
+        for (int8_t j = 0; j < MODBUS_SCHED_JOBS; j++){
+
+            J = &jobs[j];
+            if (!J->function || J->cancelled || ((long) (now - J->release) < 0)){
+                continue;
+            }
+
+            if ((J->function == READ_HOLDING_REGISTERS) && J->window && ((long) (now - J->deadline) >= 0)){
+                behind = (now - J->deadline) / J->window + 1;      // whole periods missed
+                J->stats.missed += behind;
+                totals.missed += behind;
+                J->release += behind * J->window;
+                J->deadline = J->release + J->window;
+            }
+
+            if ((best < 0) || (J->priority < jobs[best].priority) ||
+                ((J->priority == jobs[best].priority) && job_before(J, &jobs[best]))){
+                best = j;
+            }
+        }
+        return best;
+    }
+
+
+
+/**
+ * @brief Order two jobs of equal priority.  A job with a deadline goes before one without.  Jobs
+ * with deadlines go in order of them, jobs without in the order they became ready.
+ *
+ * @return 1 = A goes first
+ */
+    static uint8_t job_before(const job_t *A, const job_t *B){
+
+        if (!A->window != !B->window){
+            return A->window != 0;
+        }
+        if (!A->window){
+            return (long) (A->release - B->release) < 0;
+        }
+        return (long) (A->deadline - B->deadline) < 0;
+    }
+
+
+
+    static uint8_t job_start(int8_t j){
+
+        job_t *J = &jobs[j];
+
+        switch (J->function){
+
+            case READ_HOLDING_REGISTERS:
+                return MODBUS_submit_read(J->destination, J->slave_addr, J->addr, J->n_words);
+
+            case PRESET_SINGLE_REGISTER:
+                return MODBUS_submit_write(J->slave_addr, J->addr, J->data[0]);
+
+            default:
+                return MODBUS_submit_write_words(J->slave_addr, J->addr, J->n_words, J->data);
+        }
+    }
+
+
+
+/**
+ * @brief Count the result, then schedule the next period of a poll or free a write.
+ */
+    static void job_finish(int8_t j, uint8_t result, unsigned long now){
+
+        job_t *J = &jobs[j];
+
+        if (J->cancelled){                                          // cancelled while in progress
+            J->cancelled = 0;
+            J->function = 0;
+            return;
+        }
+
+        if (result == MODBUS_DONE){
+            J->stats.done++;
+            totals.done++;
+            J->fresh = (J->function == READ_HOLDING_REGISTERS);
+        }
+        else{
+            J->stats.failed++;
+            totals.failed++;
+        }
+
+        if (J->window && ((long) (now - J->deadline) > 0)){
+            J->stats.missed++;
+            totals.missed++;
+        }
+
+        if (J->function != READ_HOLDING_REGISTERS){
+            J->function = 0;
+            return;
+        }
+
+        if (!J->window){                                            // back to back: queue behind its equals
+            J->release = now;
+            J->deadline = now;
+            return;
+        }
+        J->release = J->deadline;                                   // the next period
+        if ((long) (now - J->release) >= (long) J->window){
+            J->release = now;                                       // more than a period behind, start over
+        }
+        J->deadline = J->release + J->window;
+    }
@@ -0,0 +1,38 @@
+#ifndef _MODBUS_SCHEDULER
+
+    #define _MODBUS_SCHEDULER
+
+    #include <stdint.h>
+
+    #include "ASCII_MODBUS.h"
+
+    #ifndef MODBUS_SCHED_JOBS
+        #define MODBUS_SCHED_JOBS       8                           // poll jobs and pending writes together
+    #endif
+
+    #ifndef MODBUS_SCHED_PUT_WORDS
+        #define MODBUS_SCHED_PUT_WORDS  8                           // registers of one write job, up to MODBUS_MAX_PUT_WORDS
+    #endif
+
+    #define MODBUS_SCHED_TOTAL          -1                          // MODBUS_sched_get_stats: every job since MODBUS_sched_init
+
+    typedef struct {                                                // see MODBUS_sched_get_stats
+        uint16_t done;
+        uint16_t failed;
+        uint16_t missed;                                            // deadlines missed
+    } MODBUS_sched_stats_t;
+
+    void MODBUS_sched_init(void);
+
+    int8_t MODBUS_sched_poll(uint16_t *destination, uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t get_n_words,
+                             uint16_t period_ms, uint8_t priority);
+    int8_t MODBUS_sched_write(uint8_t physical_addr, uint16_t mem_addr, uint16_t data, uint16_t deadline_ms, uint8_t priority);
+    int8_t MODBUS_sched_write_words(uint8_t physical_addr, uint16_t starting_mem_addr, uint16_t n_words, const uint16_t *data,
+                                    uint16_t deadline_ms, uint8_t priority);
+    void MODBUS_sched_cancel(int8_t job);
+
+    uint8_t MODBUS_sched_service(void);
+    uint8_t MODBUS_sched_is_fresh(int8_t job);
+    void MODBUS_sched_get_stats(int8_t job, MODBUS_sched_stats_t *S);
+
+#endif
@@ -1,20 +1,70 @@
+/**
+ * @file USART.h
+ *
+ * @brief Public interface to the USART driver.  The driver itself is in USART_instance.h which
+ * must be included once by the main sketch.
+ */
+
 #ifndef _USART_H
 
     #define _USART_H
     #include <stdint.h>
+    #include "USART_baud.h"
+
+    typedef struct {                                                // a received line in place within the circular buffer
+        const char *seg_1;
+        uint8_t len_1;
+        const char *seg_2;                                          // used only when the line wraps
+        uint8_t len_2;
+    } USART_line_t;
+
+    typedef struct {                                                // receive error accounting, see USART_get_stats
+        uint16_t overrun;
+        uint16_t framing;
+        uint16_t parity;
+        uint16_t dropped;
+        uint8_t high_water;
+        uint16_t filtered;                                          // lines or frames discarded, see USART_set_filter
+    } USART_stats_t;
 
     void USART_handle_ISR(void);
+    void USART_handle_TX_ISR(void);
+    void USART_handle_TXC_ISR(void);
 
     void USART_init_full(unsigned long f_clk, unsigned long baud_rate, uint8_t data_bits, char parity);
     void USART_init(unsigned long f_clk, unsigned long baud_rate);
+    void USART_init_UBRR(uint16_t UBRR, uint8_t U2X, uint8_t data_bits, char parity);
 
     void USART_set_terminator(char terminator);
+    uint8_t USART_init_frames(uint16_t silence_us);
+    uint8_t USART_set_filter(const char *accept_1, const char *accept_2, uint8_t len);
 
     uint8_t USART_gets(char *P);
+    uint8_t USART_read(char *D, uint8_t N, uint8_t *end);
+
+    uint8_t USART_peek_line(USART_line_t *L);
+    void USART_release_line(void);
+
+    static inline char USART_line_char(const USART_line_t *L, uint8_t N){
+        return (N < L->len_1) ? L->seg_1[N] : L->seg_2[N - L->len_1];
+    }
+
+    void USART_write(const char *D, uint8_t N);
     void USART_puts(char *D);
 
     void USART_puts_ROM(const char *D);
 
+    void USART_nb_puts(char *D);
+    void USART_nb_puts_ROM(const char *D);
+    void USART_nb_write(const char *D, uint8_t N);
+    uint8_t USART_is_TX_idle(void);
+    void USART_set_TX_done(void (*done)(void));
+    void USART_flush(void);
+
     uint8_t USART_is_string(void);
+    uint8_t USART_is_RX_empty(void);
+
+    void USART_get_stats(USART_stats_t *S);
+    void USART_reset_stats(void);
 
 #endif
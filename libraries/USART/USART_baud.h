@@ -0,0 +1,91 @@
+/**
+ * @file USART_baud.h
+ *
+ * @brief Select the USART baud rate register (UBRR) and double speed bit (U2X) for the lowest baud
+ * rate error.  The calculation is done by the compiler when the clock and baud rate are constants.
+ *
+ *                   f_osc                                       f_osc
+ *      BAUD = -----------------   (U2X = 0)       BAUD = ----------------   (U2X = 1)
+ *              16 * (UBRR + 1)                            8 * (UBRR + 1)
+ *
+ * UBRR is rounded to the nearest integer rather than truncated.  U2X is used only when it gives a
+ * lower error.  Normal speed is preferred on a tie since its receiver has the better tolerance.
+ *
+ * Some results at 16 MHz:
+ *
+ *      baud    | U2X | UBRR | error
+ *      --------|-----|------|-------
+ *        9600  |  0  |  103 | 0.2 %
+ *       19200  |  0  |   51 | 0.2 %
+ *      115200  |  1  |   16 | 2.1 %
+ *      250000  |  0  |    3 | 0.0 %
+ *      500000  |  0  |    1 | 0.0 %
+ *     1000000  |  0  |    0 | 0.0 %
+ *
+ * \b Example:
+ *    @code
+ *          USART_INIT_BAUD(16000000UL, 250000UL, 8, 'N');           // fails to compile if the error is too large
+ *    @endcode
+ */
+
+#ifndef _USART_BAUD_H
+
+    #define _USART_BAUD_H
+
+    #include <stdint.h>
+
+
+    #ifndef USART_BAUD_MAX_ERROR
+        #define USART_BAUD_MAX_ERROR 25                             // tenths of a percent i.e., 2.5 %
+    #endif
+
+
+    constexpr uint32_t USART_baud_UBRR(uint32_t f_clk, uint32_t baud, uint8_t div){
+
+        return (((f_clk + (div * baud) / 2) / (div * baud)) > 0) ? (((f_clk + (div * baud) / 2) / (div * baud)) - 1) : 0;
+    }
+
+
+    constexpr uint32_t USART_baud_actual(uint32_t f_clk, uint32_t baud, uint8_t div){
+
+        return f_clk / (div * (USART_baud_UBRR(f_clk, baud, div) + 1));
+    }
+
+
+/**
+ * @return the baud rate error in tenths of a percent
+ */
+    constexpr uint32_t USART_baud_error(uint32_t f_clk, uint32_t baud, uint8_t div){
+
+        return ((USART_baud_actual(f_clk, baud, div) > baud) ?
+                    (USART_baud_actual(f_clk, baud, div) - baud) :
+                    (baud - USART_baud_actual(f_clk, baud, div))) * 1000UL / baud;
+    }
+
+
+    constexpr uint8_t USART_baud_U2X(uint32_t f_clk, uint32_t baud){
+
+        return ((USART_baud_UBRR(f_clk, baud, 8) <= 4095) &&
+                (USART_baud_error(f_clk, baud, 8) < USART_baud_error(f_clk, baud, 16))) ? 1 : 0;
+    }
+
+
+/**
+ * @brief The baud rate settings for a given clock and baud rate.  The compiler stops with an error
+ * if the best setting is off by more than max_error tenths of a percent.
+ */
+    template <uint32_t f_osc, uint32_t baud, uint16_t max_error = USART_BAUD_MAX_ERROR> struct USART_baud {
+
+        static const uint8_t U2X = USART_baud_U2X(f_osc, baud);
+        static const uint16_t UBRR = USART_baud_UBRR(f_osc, baud, U2X ? 8 : 16);
+        static const uint16_t error = USART_baud_error(f_osc, baud, U2X ? 8 : 16);
+
+        static_assert(USART_baud_UBRR(f_osc, baud, U2X ? 8 : 16) <= 4095, "USART_baud: baud rate is too low for this clock");
+        static_assert(error <= max_error, "USART_baud: baud rate error exceeds USART_BAUD_MAX_ERROR");
+    };
+
+
+    #define USART_INIT_BAUD(f_clk, baud, data_bits, parity) \
+        USART_init_UBRR(USART_baud<(f_clk), (baud)>::UBRR, USART_baud<(f_clk), (baud)>::U2X, (data_bits), (parity))
+
+#endif
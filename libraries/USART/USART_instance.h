@@ -0,0 +1,497 @@
+/**
+ * @file USART_instance.h
+ *
+ * @brief The USART driver instances.  This file must be included exactly once per sketch, in the
+ * main sketch file, after "USART.h".  Every other file (including libraries such as ASCII_MODBUS)
+ * uses only "USART.h".
+ *
+ * The driver is compiled with the sketch so that each sketch can choose the size of its receive
+ * and transmit buffers without editing the library.  The sizes must be a power of 2 from 2 through
+ * 256.  An improper size is caught by the compiler.  For example:
+ *
+ *    @code
+ *          #include "USART.h"
+ *
+ *          #define USART_RX_BUF_LEN 256                            // default is 128
+ *          #define USART_TX_BUF_LEN 32                             // default is 64
+ *          #include "USART_instance.h"
+ *    @endcode
+ *
+ * USART0 is always created as the object USART_0.  The functions declared in USART.h operate on
+ * it.  On parts with more than one USART (e.g., the ATmega2560) USART_1, USART_2, and USART_3 are
+ * created when the corresponding receive buffer size is defined.  These are used through their
+ * member functions:
+ *
+ *    @code
+ *          #define USART1_RX_BUF_LEN 128
+ *          #define USART1_TX_BUF_LEN 64                            // optional, default is 64
+ *          #include "USART_instance.h"
+ *
+ *          USART_1.init(F_CLK, 19200, 8, 'N');
+ *          USART_1.nb_puts(line);
+ *    @endcode
+ *
+ * The interrupt service routines for every created USART are also defined here.  The complete
+ * handler is expanded inside the ISR.  There is no call to an out-of-line function so the compiler
+ * saves only the registers the handler actually uses rather than every call-clobbered register.
+ *
+ * Originally the sketch had to define the ISR and call USART_handle_ISR.  Arduino reports
+ * "multiple definition of `vector_18" if the ISR is placed in a library .cpp file.  This file is
+ * compiled as part of the main sketch so the ISRs defined here avoid that error.  Note that the
+ * Arduino Serial object uses the same vectors.  It cannot be used on a USART created here.
+ *
+ * Define USART_CUSTOM_ISR before including this file to suppress the ISRs.  The sketch must then
+ * define them itself, for example:
+ *
+ *    @code
+ *          ISR(USART_RX_vect){
+ *              USART_handle_ISR();
+ *          }
+ *    @endcode
+ *
+ * Define USART_FRAME_TIMER before including this file to divide the USART_0 input into frames by
+ * silence on the line (e.g., MODBUS RTU) instead of by a terminator.  Timer2 is then used to time
+ * the silence and its compare match ISR is defined here.  Timer2 is also used by the Arduino
+ * tone() function.  The two cannot be used together.  See USART_init_frames.
+ */
+
+#ifdef _USART_INSTANCE_H
+    #error "USART_instance.h must be included only once, in the main sketch"
+#endif
+
+    #define _USART_INSTANCE_H
+
+// AVR Libc includes
+    #include <avr/io.h>
+    #include <avr/interrupt.h>
+    #include <stdint.h>
+
+    #include "USART.h"
+    #include "USART_port.h"
+
+
+/* Set the size of the circular buffers */
+
+    #ifndef USART_RX_BUF_LEN
+        #define USART_RX_BUF_LEN 128                                // must be a power of 2 (PO2)
+    #endif
+
+    #ifndef USART_TX_BUF_LEN
+        #define USART_TX_BUF_LEN 64                                 // must be a power of 2 (PO2)
+    #endif
+
+
+// Driver instances
+
+    USART_port<USART0_hw, USART_RX_BUF_LEN, USART_TX_BUF_LEN> USART_0;
+
+    #ifdef USART1_RX_BUF_LEN
+        #ifndef USART1_TX_BUF_LEN
+            #define USART1_TX_BUF_LEN 64
+        #endif
+        USART_port<USART1_hw, USART1_RX_BUF_LEN, USART1_TX_BUF_LEN> USART_1;
+    #endif
+
+    #ifdef USART2_RX_BUF_LEN
+        #ifndef USART2_TX_BUF_LEN
+            #define USART2_TX_BUF_LEN 64
+        #endif
+        USART_port<USART2_hw, USART2_RX_BUF_LEN, USART2_TX_BUF_LEN> USART_2;
+    #endif
+
+    #ifdef USART3_RX_BUF_LEN
+        #ifndef USART3_TX_BUF_LEN
+            #define USART3_TX_BUF_LEN 64
+        #endif
+        USART_port<USART3_hw, USART3_RX_BUF_LEN, USART3_TX_BUF_LEN> USART_3;
+    #endif
+
+
+
+/*******************************************************************************
+ *  The functions declared in USART.h.  All operate on USART_0.
+ ******************************************************************************/
+
+
+#ifdef USART_FRAME_TIMER
+
+    static uint8_t USART_frame_timer_CS = 0;                        // Timer2 clock select, 0 = stopped
+
+
+/** USART_frame_timer_restart
+ *
+ * @brief Start timing the silence again.  Called by the receive ISR for every character.  Call it
+ * after USART_handle_ISR when USART_CUSTOM_ISR is defined.
+ */
+    static inline void USART_frame_timer_restart(void){
+
+        TCNT2 = 0;
+        TCCR2B = USART_frame_timer_CS;
+    }
+
+#endif
+
+
+ /** USART_handle_ISR
+ * @brief This Interrupt Service Routine is called when a new character is received by the USART.
+ * See USART_port::handle_RX_ISR.
+ *
+ * @note Only needed when USART_CUSTOM_ISR is defined.  Otherwise the ISR is defined below.  See
+ * discussion of the "multiple definition of `vector_18" error at:
+ *
+ *     http://forum.arduino.cc/index.php?topic=42153.0
+ *
+ * @note The vector name is not "USART_RXC" as indicated in the data sheet.
+ * Instead, the ATMega328p "iom328p.h" file identified the name as "USART_RX_vect".
+ */
+void USART_handle_ISR(void){
+
+    USART_0.handle_RX_ISR();
+}
+
+
+/** USART_handle_TX_ISR
+ *
+ * @brief Call from ISR(USART_UDRE_vect) when USART_CUSTOM_ISR is defined.  See
+ * USART_port::handle_UDRE_ISR.
+ */
+void USART_handle_TX_ISR(void){
+
+    USART_0.handle_UDRE_ISR();
+}
+
+
+/** USART_handle_TXC_ISR
+ *
+ * @brief Call from ISR(USART_TX_vect) when USART_CUSTOM_ISR is defined.  See
+ * USART_port::handle_TXC_ISR.
+ */
+void USART_handle_TXC_ISR(void){
+
+    USART_0.handle_TXC_ISR();
+}
+
+
+void USART_init_full(unsigned long f_clk, unsigned long baud_rate, uint8_t data_bits, char parity){
+
+    USART_0.init(f_clk, baud_rate, data_bits, parity);
+}
+
+
+void USART_init_UBRR(uint16_t UBRR, uint8_t U2X, uint8_t data_bits, char parity){
+
+    USART_0.init_UBRR(UBRR, U2X, data_bits, parity);
+}
+
+
+void USART_init(unsigned long f_clk, unsigned long baud_rate){
+
+    USART_0.init(f_clk, baud_rate, 8, 'N');
+}
+
+
+void USART_set_terminator(char terminator){
+
+    USART_0.set_terminator(terminator);
+}
+
+
+/** USART_init_frames
+ *
+ * @brief Divide the received characters into frames that end when the line has been silent for
+ * silence_us microseconds.  A frame is read with USART_peek_line and USART_release_line.  Any
+ * characters already received are discarded.  Call after USART_init.
+ *
+ * Timer2 runs in CTC mode at F_CPU / 256 (16 uS per count at 16 MHz) or, for silences longer than
+ * 4 mS, at F_CPU / 1024.  Each received character clears the count.  The compare match ISR ends
+ * the frame and stops the timer until the next character.
+ *
+ * @param silence_us the idle time that ends a frame.  For MODBUS RTU this is 3.5 characters.
+ *
+ * @return 1 = success, 0 = the silence is longer than the timer can measure or USART_FRAME_TIMER
+ *         was not defined by the sketch
+ */
+uint8_t USART_init_frames(uint16_t silence_us){
+
+    #ifdef USART_FRAME_TIMER
+
+        uint32_t ticks = ((uint32_t) silence_us * (F_CPU / 1000000UL)) / 256;
+        uint8_t CS = (1 << CS22) | (1 << CS21);                     // clk / 256
+        uint8_t sreg;
+
+        if (ticks > 256){
+            ticks = ticks / 4;
+            CS = (1 << CS22) | (1 << CS21) | (1 << CS20);           // clk / 1024
+        }
+        if (ticks > 256){
+            return 0x00;
+        }
+        if (ticks == 0){
+            ticks = 1;
+        }
+
+        sreg = SREG;
+        cli();
+        TCCR2B = 0;                                                 // stopped until the first character
+        TCCR2A = (1 << WGM21);                                      // CTC - clear the count on compare match
+        OCR2A = ticks - 1;
+        TIFR2 = (1 << OCF2A);
+        TIMSK2 = (1 << OCIE2A);
+        USART_frame_timer_CS = CS;
+        SREG = sreg;
+
+        USART_0.set_frame_mode(1);
+        return 0x01;
+
+    #else
+
+        (void) silence_us;
+        return 0x00;
+
+    #endif
+}
+
+
+/** USART_set_filter
+ *
+ * @brief Discard, in the receive ISR, the lines or frames that do not begin with accept_1 or
+ * accept_2.  See USART_port::set_filter.
+ *
+ * \b Example:
+ *    @code
+ *          USART_set_filter(":07", ":00", 3);                      // MODBUS ASCII station 7 and broadcasts
+ *    @endcode
+ */
+uint8_t USART_set_filter(const char *accept_1, const char *accept_2, uint8_t len){
+
+    return USART_0.set_filter(accept_1, accept_2, len);
+}
+
+
+uint8_t USART_gets(char *P){
+
+    return USART_0.gets(P);
+}
+
+
+uint8_t USART_read(char *D, uint8_t N, uint8_t *end){
+
+    return USART_0.read(D, N, end);
+}
+
+
+void USART_get_stats(USART_stats_t *S){
+
+    USART_0.get_stats(S);
+}
+
+
+void USART_reset_stats(void){
+
+    USART_0.reset_stats();
+}
+
+
+/** USART_peek_line
+ *
+ * @brief Locate the next line without copying it out of the circular buffer.  See
+ * USART_port::peek_line.
+ *
+ * \b Example:
+ *    @code
+ *          USART_line_t L;
+ *
+ *          if (USART_peek_line(&L)){
+ *              for (i = 0; i < L.len_1 + L.len_2; i++){
+ *                  c = USART_line_char(&L, i);
+ *              }
+ *              USART_release_line();
+ *          }
+ *    @endcode
+ */
+uint8_t USART_peek_line(USART_line_t *L){
+
+    return USART_0.peek_line(L);
+}
+
+
+void USART_release_line(void){
+
+    USART_0.release_line();
+}
+
+
+uint8_t USART_is_string(void){
+
+    return USART_0.is_string();
+}
+
+
+uint8_t USART_is_RX_empty(void){
+
+    return USART_0.is_RX_empty();
+}
+
+
+void USART_puts(char *D){
+
+    USART_0.puts(D);
+}
+
+
+void USART_write(const char *D, uint8_t N){
+
+    USART_0.write(D, N);
+}
+
+
+void USART_puts_ROM(const char *D){                                 // TODO change to void USART_puts(const char *D);
+
+    USART_0.puts(D);
+}
+
+
+void USART_nb_puts(char *D){
+
+    USART_0.nb_puts(D);
+}
+
+
+void USART_nb_puts_ROM(const char *D){
+
+    USART_0.nb_puts(D);
+}
+
+
+void USART_nb_write(const char *D, uint8_t N){
+
+    USART_0.nb_write(D, N);
+}
+
+
+uint8_t USART_is_TX_idle(void){
+
+    return USART_0.is_TX_idle();
+}
+
+
+/** USART_set_TX_done
+ *
+ * @brief Call done from the transmit complete ISR at the end of every non-blocking transmission
+ * e.g., to release an RS-485 transceiver.  See USART_port::set_TX_done.
+ */
+void USART_set_TX_done(void (*done)(void)){
+
+    USART_0.set_TX_done(done);
+}
+
+
+void USART_flush(void){
+
+    USART_0.flush();
+}
+
+
+
+/*******************************************************************************
+ *  Interrupt Service Routines
+ ******************************************************************************/
+
+#ifndef USART_CUSTOM_ISR
+
+    #if defined(USART_RX_vect)                                      // ATmega328p
+
+        ISR(USART_RX_vect){
+            USART_0.handle_RX_ISR();
+            #ifdef USART_FRAME_TIMER
+                USART_frame_timer_restart();
+            #endif
+        }
+
+        ISR(USART_UDRE_vect){
+            USART_0.handle_UDRE_ISR();
+        }
+
+        ISR(USART_TX_vect){
+            USART_0.handle_TXC_ISR();
+        }
+
+    #elif defined(USART0_RX_vect)                                   // ATmega2560
+
+        ISR(USART0_RX_vect){
+            USART_0.handle_RX_ISR();
+            #ifdef USART_FRAME_TIMER
+                USART_frame_timer_restart();
+            #endif
+        }
+
+        ISR(USART0_UDRE_vect){
+            USART_0.handle_UDRE_ISR();
+        }
+
+        ISR(USART0_TX_vect){
+            USART_0.handle_TXC_ISR();
+        }
+
+    #endif
+
+    #ifdef USART1_RX_BUF_LEN
+
+        ISR(USART1_RX_vect){
+            USART_1.handle_RX_ISR();
+        }
+
+        ISR(USART1_UDRE_vect){
+            USART_1.handle_UDRE_ISR();
+        }
+
+        ISR(USART1_TX_vect){
+            USART_1.handle_TXC_ISR();
+        }
+
+    #endif
+
+    #ifdef USART2_RX_BUF_LEN
+
+        ISR(USART2_RX_vect){
+            USART_2.handle_RX_ISR();
+        }
+
+        ISR(USART2_UDRE_vect){
+            USART_2.handle_UDRE_ISR();
+        }
+
+        ISR(USART2_TX_vect){
+            USART_2.handle_TXC_ISR();
+        }
+
+    #endif
+
+    #ifdef USART3_RX_BUF_LEN
+
+        ISR(USART3_RX_vect){
+            USART_3.handle_RX_ISR();
+        }
+
+        ISR(USART3_UDRE_vect){
+            USART_3.handle_UDRE_ISR();
+        }
+
+        ISR(USART3_TX_vect){
+            USART_3.handle_TXC_ISR();
+        }
+
+    #endif
+
+#endif
+
+
+#ifdef USART_FRAME_TIMER
+
+    ISR(TIMER2_COMPA_vect){
+
+        TCCR2B = 0;                                                 // the line is silent - stop until the next character
+        USART_0.mark_frame();
+    }
+
+#endif
@@ -0,0 +1,966 @@
+/**
+ * @file USART_port.h
+ *
+ * @brief A USART driver that may be instantiated once for each USART in the part.  The ATmega328p
+ * has one USART while the ATmega2560 has four (USART0 - USART3).  Each instance has its own
+ * receive and transmit circular buffers, terminator count, and error statistics.
+ *
+ * The driver is a template parameterized on the register block of the USART.  Every USART in
+ * these parts has the same register layout.  Only the base address differs:
+ *
+ *      offset  | register
+ *      --------|----------
+ *        0     | UCSRnA
+ *        1     | UCSRnB
+ *        2     | UCSRnC
+ *        3     | (reserved)
+ *        4     | UBRRnL
+ *        5     | UBRRnH
+ *        6     | UDRn
+ *
+ * The register block is supplied by a small class with a regs_t type and a static regs() function.
+ * USART0_hw through USART3_hw are defined below for the AVR.  Because the address is a compile time constant
+ * the compiler generates the same direct LDS / STS instructions as the original single port code.
+ *
+ * On a Linux host the register block may be replaced with an ordinary variable.  The ISR handlers
+ * are then called directly to simulate the hardware:
+ *
+ *    @code
+ *          struct mock_hw {
+ *              typedef USART_regs_t regs_t;
+ *              static USART_regs_t block;
+ *              static USART_regs_t &regs(void){ return block; }
+ *          };
+ *          USART_regs_t mock_hw::block;
+ *
+ *          USART_port<mock_hw, 64, 64> port;
+ *
+ *          mock_hw::block.UDR = 'A';
+ *          port.handle_RX_ISR();                                   // as if 'A' had been received
+ *    @endcode
+ *
+ * A complete host model of USART0 that also simulates transmission is in host/USART_host.h.  It is
+ * selected by defining USART_HOST.
+ *
+ * Frames may be delimited by a line terminator (the default) or by silence on the line as in
+ * MODBUS RTU.  In frame mode the driver does not look at the characters.  A timer that expires
+ * when the line has been idle calls mark_frame to end the current frame.  The complete frames are
+ * then read with peek_line and release_line exactly as lines are.  See USART_init_frames in
+ * USART_instance.h.
+ *
+ * A station on a shared bus may ask the receive ISR to discard the traffic for other stations.
+ * The first characters of each line or frame are compared with one or two accepted prefixes as
+ * they arrive.  At the first mismatch the characters already stored are taken back and the rest
+ * of the line or frame is dropped without being stored.  See set_filter.
+ *
+ * @note The bit names (RXC0, UDRE0, etc.) of USART0 are used for all of the USARTs.  The bit
+ * positions are identical.
+ */
+
+#ifndef _USART_PORT_H
+
+    #define _USART_PORT_H
+
+    #include <stdint.h>
+    #include <avr/io.h>
+    #include <avr/interrupt.h>
+
+    #include "USART.h"
+    #include "USART_ring.h"
+    #include "USART_baud.h"
+
+
+    #ifndef USART_MAX_FRAMES
+        #define USART_MAX_FRAMES 4                                  // complete frames held in frame mode, must be a power of 2
+    #endif
+
+    #ifndef USART_FILTER_LEN
+        #define USART_FILTER_LEN 3                                  // longest prefix compared by the receive filter
+    #endif
+
+
+    typedef struct {                                                // register block common to all USARTs
+        volatile uint8_t UCSRA;
+        volatile uint8_t UCSRB;
+        volatile uint8_t UCSRC;
+        volatile uint8_t reserved;
+        volatile uint8_t UBRRL;
+        volatile uint8_t UBRRH;
+        volatile uint8_t UDR;
+    } USART_regs_t;
+
+
+// Register blocks of the AVR USARTs
+
+    #ifdef USART_HOST
+
+        #include "USART_host.h"                                     // register model for Linux builds, see host/
+
+        #define USART_WAIT() host_USART_wait()                      // let the model's interrupts run while the driver waits
+
+    #else
+
+        #define USART_WAIT()
+
+    struct USART0_hw {
+        typedef USART_regs_t regs_t;
+        static inline regs_t &regs(void){ return *(USART_regs_t *) &UCSR0A; }
+    };
+
+    #ifdef UCSR1A
+    struct USART1_hw {
+        typedef USART_regs_t regs_t;
+        static inline regs_t &regs(void){ return *(USART_regs_t *) &UCSR1A; }
+    };
+    #endif
+
+    #ifdef UCSR2A
+    struct USART2_hw {
+        typedef USART_regs_t regs_t;
+        static inline regs_t &regs(void){ return *(USART_regs_t *) &UCSR2A; }
+    };
+    #endif
+
+    #ifdef UCSR3A
+    struct USART3_hw {
+        typedef USART_regs_t regs_t;
+        static inline regs_t &regs(void){ return *(USART_regs_t *) &UCSR3A; }
+    };
+    #endif
+
+    #endif
+
+
+
+/**
+ * @brief The driver for one USART.
+ *
+ * @param HW supplies the register block e.g., USART0_hw
+ *
+ * @param RX_LEN size of the receive circular buffer (power of 2 from 2 through 256)
+ *
+ * @param TX_LEN size of the transmit circular buffer (power of 2 from 2 through 256)
+ *
+ * @note Declare instances as global variables.  The ISR handlers and the main loop functions
+ * share the object.
+ */
+    template <class HW, uint16_t RX_LEN, uint16_t TX_LEN> class USART_port {
+
+    public:
+
+        USART_port(void){
+            line_terminator = 0x0A;                                 // default is ASCII Line Feed
+        }
+
+
+    /**
+     * @brief Configure the USART and configure the ISR to interrupt on receipt of a new char.
+     *
+     * UBRR and U2X are selected for the lowest baud rate error.  See USART_baud.h.  When the clock
+     * and baud rate are constants prefer init_UBRR with USART_baud so that an unusable baud rate
+     * is caught by the compiler.
+     *
+     * @param f_clk master clock frequency, usually 16000000 MHz for the Arduino
+     *
+     * @param baud_rate desired speed of the USART e.g., 19200L
+     *
+     * @param data_bits currently accepts either 7 or 8 bits
+     *
+     * @param parity 'N' = None, 'E' = Even, and 'O' = Odd
+     */
+        void init(unsigned long f_clk, unsigned long baud_rate, uint8_t data_bits, char parity){
+
+            uint8_t U2X = USART_baud_U2X(f_clk, baud_rate);
+
+            init_UBRR(USART_baud_UBRR(f_clk, baud_rate, U2X ? 8 : 16), U2X, data_bits, parity);
+        }
+
+
+    /**
+     * @brief Configure the USART with a precomputed baud rate setting e.g.,
+     *
+     *    @code
+     *          USART_0.init_UBRR(USART_baud<16000000UL, 500000UL>::UBRR, USART_baud<16000000UL, 500000UL>::U2X, 8, 'N');
+     *    @endcode
+     *
+     * @param UBRR value for the baud rate register
+     *
+     * @param U2X 1 = double speed operation
+     */
+        void init_UBRR(uint16_t UBRR, uint8_t U2X, uint8_t data_bits, char parity){
+
+            typename HW::regs_t &R = HW::regs();
+            uint8_t C = 0;
+
+            cli();                                                  // Disable global
+            R.UBRRH = (uint8_t)(UBRR >> 8);                         // Set the baud rate generator
+            R.UBRRL = (uint8_t)UBRR;
+            R.UCSRA = U2X ? (1 << U2X0) : 0;
+            R.UCSRB = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);  // Enable the USART hardware as well as the interrupt flag
+            if (TX_done){
+                R.UCSRB |= (1 << TXCIE0);                           // keep the TX complete hook, see set_TX_done
+            }
+
+            if (data_bits == 8)
+                C = (0 << UCSZ02) | (1 << UCSZ01) | (1 << UCSZ00);
+            if (data_bits == 7)
+                C = (0 << UCSZ02) | (1 << UCSZ01) | (0 << UCSZ00);
+            if (parity == 'N')
+                C = C | ((0 << UPM01) | (0 << UPM00));
+            if (parity == 'E')
+                C = C | ((1 << UPM01) | (0 << UPM00));
+            if (parity == 'O')
+                C = C | ((1 << UPM01) | (1 << UPM00));
+            R.UCSRC = C;
+
+            sei();                                                  // Enable global
+        }
+
+
+    /**
+     * @brief Set the string line terminator.  Characters already in the circular buffer are
+     * recounted against the new terminator.  This also ends frame mode.
+     */
+        void set_terminator(char terminator){
+
+            uint8_t sreg = SREG;
+
+            cli();
+            frame_mode = 0x00;
+            line_terminator = terminator;
+            line_count = 0;
+            for (uint8_t i = rx.tail; i != rx.head; i = rx.next(i)){
+                if (rx.buf[i] == terminator){
+                    line_count++;
+                }
+            }
+            filter_restart();
+            SREG = sreg;
+        }
+
+
+    /**
+     * @brief Select how the received characters are divided.  Any characters already in the
+     * receive buffer are discarded.
+     *
+     * @param on 0 = lines end with the terminator (see set_terminator), 1 = frames end when
+     *        mark_frame is called
+     */
+        void set_frame_mode(uint8_t on){
+
+            uint8_t sreg = SREG;
+
+            cli();
+            frame_mode = on;
+            rx.tail = rx.head;
+            frame_start = rx.head;
+            frame_open = 0x00;
+            frame_head = 0;
+            frame_tail = 0;
+            line_count = 0;
+            peek_valid = 0x00;
+            filter_restart();
+            SREG = sreg;
+        }
+
+
+    /**
+     * @brief Discard, in the receive ISR, the lines or frames that do not begin with one of two
+     * prefixes e.g., the start of the MODBUS ASCII frames addressed to this station and those
+     * broadcast to all stations.  A discarded line takes no room in the receive buffer and is never
+     * seen by the main loop.  Each one is counted as filtered, see get_stats.
+     *
+     * In line mode letters are compared without regard to case, in the received characters and in
+     * the prefixes alike.  ":0a" accepts the frames that begin ":0A" and ":0a".  In frame mode the
+     * characters are compared as they are.
+     *
+     * Any characters already in the receive buffer are discarded.
+     *
+     * @param accept_1 the first prefix, NULL = no filter
+     *
+     * @param accept_2 the second prefix, NULL = accept_1 only
+     *
+     * @param len the number of characters compared, 0 = no filter
+     *
+     * @return 1 = success, 0 = len is greater than USART_FILTER_LEN
+     *
+     * @warning The filter takes back the characters of a line that fails part way through its
+     * prefix.  Read complete lines or frames only (gets, peek_line).  Do not read a partial line
+     * with read while the filter is on.
+     */
+        uint8_t set_filter(const char *accept_1, const char *accept_2, uint8_t len){
+
+            uint8_t sreg = SREG;
+
+            if (len > USART_FILTER_LEN){
+                return 0x00;
+            }
+            if (!accept_1){
+                len = 0;
+            }
+            if (!accept_2){
+                accept_2 = accept_1;
+            }
+
+            cli();
+            filter_len = len;
+            for (uint8_t i = 0; i < len; i++){
+                filter[0][i] = accept_1[i];
+                filter[1][i] = accept_2[i];
+            }
+            rx.tail = rx.head;
+            frame_start = rx.head;
+            frame_open = 0x00;
+            frame_head = 0;
+            frame_tail = 0;
+            line_count = 0;
+            peek_valid = 0x00;
+            filter_restart();
+            SREG = sreg;
+            return 0x01;
+        }
+
+
+    /**
+     * @brief Call from the silence timer ISR in frame mode.  The characters received since the
+     * previous call become a complete frame.  Nothing happens if no characters have arrived.
+     *
+     * A frame that arrives while USART_MAX_FRAMES frames are already waiting is discarded.  Its
+     * characters are counted as dropped.
+     */
+        __attribute__((always_inline)) inline void mark_frame(void){
+
+            uint8_t next = (frame_head + 1) & (USART_MAX_FRAMES - 1);
+
+            filter_restart();                                       // the next frame is compared from its first character
+
+            if (!frame_open){
+                return;
+            }
+            frame_open = 0x00;
+
+            if (next == frame_tail){                                // no room - discard the new frame
+                stats.dropped += USART_ring_index<RX_LEN>::count(rx.head, frame_start);
+                rx.head = frame_start;
+                return;
+            }
+
+            frame_end[frame_head] = rx.head;
+            frame_head = next;
+            frame_start = rx.head;
+            line_count++;
+        }
+
+
+    /**
+     * @brief Call from the receive complete ISR.  As quickly as possible, the AVR transfers the
+     * character to the receive circular buffer.  The main loop code then retrieves data from this
+     * buffer.  Observe that this mechanism allows data to be received at a high rate of speed
+     * independent of the main loop.
+     *
+     * The ISR also counts the line terminators as they arrive.  This allows is_string to answer
+     * with a single compare instead of scanning the circular buffer.
+     *
+     * Receive errors are counted.  A character that arrives when the buffer is full is discarded
+     * and counted as dropped.  Unread characters are never overwritten.  In line mode the part of
+     * the line already stored is taken back as well, and the rest of the line is discarded up to
+     * and including its terminator.  Every character lost is counted as dropped.  The receiver thus
+     * starts again with the next line rather than waiting forever for a terminator that found no
+     * room.  See get_stats.
+     *
+     * When a filter is set the characters of a line or frame that has failed it are discarded
+     * before they reach the buffer.  See set_filter.
+     *
+     * @note From the ATMEL data sheet "When interrupt driven data reception is used, the receive
+     * complete routine must read the received data from UDRn in order to clear the RXCn Flag,
+     * otherwise a new interrupt will occur once the interrupt routine terminates.
+     */
+        __attribute__((always_inline)) inline void handle_RX_ISR(void){
+
+            typename HW::regs_t &R = HW::regs();
+            uint8_t status = R.UCSRA;                               // the error flags are only valid before UDR is read
+            uint8_t c = R.UDR;
+            uint8_t next = rx.next(rx.head);
+            uint8_t fill;
+
+            if (status & ((1 << DOR0) | (1 << FE0) | (1 << UPE0))){
+                if (status & (1 << DOR0))
+                    stats.overrun++;
+                if (status & (1 << FE0))
+                    stats.framing++;
+                if (status & (1 << UPE0))
+                    stats.parity++;
+            }
+
+            if (overflow_skip){                                     // the rest of a line that did not fit
+                stats.dropped++;
+                if (c == line_terminator){
+                    filter_restart();
+                }
+                return;
+            }
+
+            if (filter_len && !filter_accept(c)){
+                return;
+            }
+
+            if (next == rx.tail){                                   // full - keep the unread data and discard the new char
+                stats.dropped++;
+                if (!frame_mode){
+                    stats.dropped += USART_ring_index<RX_LEN>::count(rx.head, line_start);
+                    rx.head = line_start;                           // take back the partial line
+                    if (c == line_terminator)
+                        filter_restart();
+                    else
+                        overflow_skip = 0x01;                       // until the terminator
+                }
+                return;
+            }
+
+            rx.buf[rx.head] = c;
+            rx.head = next;
+
+            fill = rx.count();
+            if (fill > stats.high_water){
+                stats.high_water = fill;
+            }
+            if (frame_mode){
+                frame_open = 0x01;
+            }
+            else if (c == line_terminator){
+                line_count++;
+                filter_restart();                                   // the next line is compared from its first character
+            }
+        }
+
+
+    /**
+     * @brief Call from the data register empty (UDRE) ISR.  It moves the next queued character
+     * from the transmit circular buffer into UDR.  When the buffer has been drained the UDRE
+     * interrupt is disabled; the next call to nb_puts will enable it again.
+     *
+     * @note Loading UDR does not clear the TXC flag.  The ISR clears it with each character by
+     * writing a one to TXC0 in UCSRA.  TXC is then set only once the final stop bit has left the
+     * shift register, which is what is_TX_idle relies on.  Do not remove that write.
+     */
+        __attribute__((always_inline)) inline void handle_UDRE_ISR(void){
+
+            typename HW::regs_t &R = HW::regs();
+
+            if (!tx.is_empty()){
+                R.UDR = tx.buf[tx.tail];
+                R.UCSRA = (R.UCSRA & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);  // FE, DOR, and UPE must be written as zero
+                tx.tail = tx.next(tx.tail);
+            }
+            if (tx.is_empty()){
+                R.UCSRB &= ~(1 << UDRIE0);                          // nothing left to send
+            }
+        }
+
+
+    /**
+     * @brief Call from the transmit complete (TXC) ISR.  The interrupt is enabled only while a hook
+     * is set by set_TX_done.  The hook is called once the final stop bit of the queued characters
+     * has left the shift register.
+     *
+     * @note The TXC flag is cleared by the hardware when the ISR runs.
+     */
+        __attribute__((always_inline)) inline void handle_TXC_ISR(void){
+
+            if (tx_busy && tx.is_empty()){
+                tx_busy = 0x00;
+                if (TX_done){
+                    TX_done();
+                }
+            }
+        }
+
+
+    /**
+     * @brief Call a function from the TXC ISR at the end of every non-blocking transmission e.g.,
+     * to release an RS-485 transceiver at the earliest possible moment.  The function runs at
+     * interrupt level and must be short.  Pass 0 to remove it.  The call through a pointer makes the
+     * ISR save every call-clobbered register.  That cost is paid once per transmission, not per
+     * character.
+     *
+     * @note Only the non-blocking functions (nb_puts, nb_write, ...) mark the transmitter as busy.
+     * The hook is not called after puts or write.
+     */
+        void set_TX_done(void (*done)(void)){
+
+            typename HW::regs_t &R = HW::regs();
+            uint8_t sreg = SREG;
+
+            cli();
+            TX_done = done;
+            if (done){
+                R.UCSRA = (R.UCSRA & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0);  // clear a flag left from an earlier transmission
+                R.UCSRB |= (1 << TXCIE0);
+            }
+            else{
+                R.UCSRB &= ~(1 << TXCIE0);
+            }
+            SREG = sreg;
+        }
+
+
+    /**
+     * @brief Copy the next line from the circular buffer to P.  The terminator is removed from the
+     * buffer but is not copied.
+     *
+     * @warning Do not mix with peek_line.  Release a peeked line before calling this function.
+     *
+     * @warning Lines only.  Use peek_line in frame mode.
+     *
+     * @return the number of characters copied
+     */
+        uint8_t gets(char *P){
+
+            uint8_t num_char = 0;
+            uint8_t sreg;
+
+            while (!rx.is_empty()){
+                if (rx.buf[rx.tail] == line_terminator){
+                    rx.tail = rx.next(rx.tail);
+                    sreg = SREG;
+                    cli();                                          // the ISR also modifies line_count
+                    line_count--;
+                    SREG = sreg;
+                    break;
+                }
+                *P = rx.buf[rx.tail];
+                num_char++;
+                P++;
+                rx.tail = rx.next(rx.tail);
+            }
+            *P = 0x00;                                              // null terminate
+            return num_char;
+        }
+
+
+    /**
+     * @brief Remove up to N characters from the circular buffer whether or not the rest of the
+     * line has arrived.  Use this to process a message that is longer than the buffer as it
+     * arrives.  The copy stops after a line terminator (which is copied) or at the end of a
+     * complete frame.
+     *
+     * @warning Do not mix with peek_line.  Release a peeked line before calling this function.
+     *
+     * @param end set to 1 when the copy stopped at the end of a line or frame, otherwise 0
+     *
+     * @return the number of characters copied
+     */
+        uint8_t read(char *D, uint8_t N, uint8_t *end){
+
+            uint8_t num_char = 0;
+            uint8_t stop;
+            uint8_t sreg = SREG;
+
+            *end = 0x00;
+            cli();                                                  // the ISR modifies the frame and line accounting
+            stop = (frame_mode && line_count) ? frame_end[frame_tail] : rx.head;
+            SREG = sreg;
+
+            while ((num_char < N) && (rx.tail != stop)){
+                D[num_char++] = rx.buf[rx.tail];
+                rx.tail = rx.next(rx.tail);
+                if (!frame_mode && (D[num_char - 1] == line_terminator)){
+                    cli();
+                    line_count--;
+                    SREG = sreg;
+                    *end = 0x01;
+                    return num_char;
+                }
+            }
+
+            if (frame_mode){
+                cli();
+                if (line_count && (rx.tail == frame_end[frame_tail])){
+                    frame_tail = (frame_tail + 1) & (USART_MAX_FRAMES - 1);
+                    line_count--;
+                    *end = 0x01;
+                }
+                else if (!line_count){
+                    frame_start = rx.tail;                          // part of the open frame has been taken
+                }
+                SREG = sreg;
+            }
+            return num_char;
+        }
+
+
+    /**
+     * @brief Retrieve a snapshot of the receive error counters.  Use these to tell a main loop
+     * that falls behind (dropped characters and a high water mark near the buffer size) from a
+     * noisy line (framing and parity errors).
+     *
+     *      overrun     DOR - a character was lost in the USART because the ISR was late
+     *      framing     FE - the stop bit was not found e.g., baud rate mismatch or noise
+     *      parity      UPE - parity error (only when parity is enabled)
+     *      dropped     characters discarded because the circular buffer was full
+     *      high_water  the greatest number of characters held in the circular buffer
+     *      filtered    lines or frames discarded by the receive filter, see set_filter
+     */
+        void get_stats(USART_stats_t *S){
+
+            uint8_t sreg = SREG;
+
+            cli();
+            S->overrun = stats.overrun;
+            S->framing = stats.framing;
+            S->parity = stats.parity;
+            S->dropped = stats.dropped;
+            S->high_water = stats.high_water;
+            S->filtered = stats.filtered;
+            SREG = sreg;
+        }
+
+
+    /**
+     * @brief Clear all of the receive error counters and the high water mark.
+     */
+        void reset_stats(void){
+
+            uint8_t sreg = SREG;
+
+            cli();
+            stats.overrun = 0;
+            stats.framing = 0;
+            stats.parity = 0;
+            stats.dropped = 0;
+            stats.high_water = 0;
+            stats.filtered = 0;
+            SREG = sreg;
+        }
+
+
+    /**
+     * @brief Locate the next line without copying it out of the circular buffer.  The line is
+     * described as one or two contiguous segments inside the buffer.  There are two segments when
+     * the line wraps past the end of the buffer.  The terminator is not part of either segment.
+     *
+     * The line remains in the buffer until release_line is called.  The ISR only writes at HEAD
+     * so the segments stay valid in the meantime.
+     *
+     * In frame mode L describes the next complete frame.  There is no terminator.
+     *
+     * @return 0 = no complete line, 1 = L describes the next line
+     */
+        uint8_t peek_line(USART_line_t *L){
+
+            uint8_t tail = rx.tail;
+            uint8_t i = tail;
+
+            if (!line_count){
+                return 0x00;
+            }
+
+            if (frame_mode){
+                i = frame_end[frame_tail];                          // one past the last character
+                peek_term = i;
+            }
+            else{
+                while (rx.buf[i] != line_terminator){
+                    i = rx.next(i);
+                }
+                peek_term = rx.next(i);
+            }
+            peek_valid = 0x01;
+
+            L->seg_1 = (const char *) &rx.buf[tail];
+            L->seg_2 = (const char *) &rx.buf[0];
+            if (i >= tail){
+                L->len_1 = i - tail;
+                L->len_2 = 0;
+            }
+            else{
+                L->len_1 = RX_LEN - tail;
+                L->len_2 = i;
+            }
+            return 0x01;
+        }
+
+
+    /**
+     * @brief Remove the line found by peek_line (and its terminator) from the circular buffer.
+     * The call does nothing if there is no peeked line.
+     */
+        void release_line(void){
+
+            uint8_t sreg;
+
+            if (!peek_valid){
+                return;
+            }
+            sreg = SREG;
+            cli();
+            rx.tail = peek_term;
+            line_count--;
+            if (frame_mode){
+                frame_tail = (frame_tail + 1) & (USART_MAX_FRAMES - 1);
+            }
+            SREG = sreg;
+            peek_valid = 0x00;
+        }
+
+
+    /**
+     * @brief Determine if a complete line is waiting in the circular buffer.  The terminators are
+     * counted by handle_RX_ISR as they arrive so this is a single compare.
+     *
+     * @return 0 = no complete line, 1 = at least one line is ready
+     */
+        inline uint8_t is_string(void){
+
+            return (line_count != 0);
+        }
+
+
+    /**
+     * @brief Determine if no characters at all are waiting.  A line that has begun to arrive is
+     * not empty.
+     *
+     * @return 1 = empty, 0 = at least one character has been received
+     */
+        inline uint8_t is_RX_empty(void){
+
+            return rx.is_empty();
+        }
+
+
+    /**
+     * @brief Blocking transmit of a null terminated string.  Any queued characters are sent first.
+     */
+        void puts(const char *D){
+
+            typename HW::regs_t &R = HW::regs();
+
+            while (!tx.is_empty()){                                 // let any queued characters go first
+                USART_WAIT();
+            }
+
+            while (*D != 0x00){
+                while ( !( R.UCSRA & (1 << UDRE0)) );               // wait for room in the data register
+                R.UDR = *D;
+                D++;
+            }
+        }
+
+
+    /**
+     * @brief Blocking transmit of exactly N characters.  Unlike puts the source need not be null
+     * terminated.  This allows a segment returned by peek_line to be sent directly.
+     */
+        void write(const char *D, uint8_t N){
+
+            typename HW::regs_t &R = HW::regs();
+
+            while (!tx.is_empty()){
+                USART_WAIT();
+            }
+
+            while (N--){
+                while ( !( R.UCSRA & (1 << UDRE0)) );
+                R.UDR = *D;
+                D++;
+            }
+        }
+
+
+    /**
+     * @brief Non-blocking transmit.  The string is copied to the transmit circular buffer and then
+     * sent by handle_UDRE_ISR while the main loop continues with other work.
+     *
+     * At 19200 baud a 17 character MODBUS frame occupies the line for approximately 8.9 mS.  With
+     * puts the main loop is held for that entire time.  With this function it is held only for the
+     * time required to copy 17 bytes into the buffer.
+     *
+     * @note Strings longer than TX_LEN - 1 are accepted.  The call then waits until all but the
+     * final TX_LEN - 1 characters have been handed to the USART.
+     */
+        void nb_puts(const char *D){
+
+            while(*D != 0x00){
+                nb_putc(*D);
+                D++;
+            }
+        }
+
+
+    /**
+     * @brief Non-blocking transmit of exactly N characters.  Unlike nb_puts the source need not be
+     * null terminated e.g., a binary MODBUS RTU frame.  See nb_puts.
+     */
+        void nb_write(const char *D, uint8_t N){
+
+            while(N--){
+                nb_putc(*D);
+                D++;
+            }
+        }
+
+
+    /**
+     * @brief Determine if the transmitter has finished.  Both the transmit circular buffer and the
+     * USART shift register must be empty.  This is the test to use before releasing an RS-485
+     * transceiver.
+     *
+     * @return 0 = characters are still being sent, 1 = idle
+     *
+     * @note With a hook set by set_TX_done the TXC ISR decides.  The hook is then never skipped.
+     */
+        uint8_t is_TX_idle(void){
+
+            if (tx_busy && !TX_done && tx.is_empty() && (HW::regs().UCSRA & (1 << TXC0))){
+                tx_busy = 0x00;
+            }
+            return !tx_busy;
+        }
+
+
+    /**
+     * @brief Wait until every queued character, including its stop bit, has been sent.
+     */
+        void flush(void){
+
+            while (!is_TX_idle()){
+                USART_WAIT();
+            }
+        }
+
+
+    private:
+
+        static_assert((USART_MAX_FRAMES & (USART_MAX_FRAMES - 1)) == 0, "USART_MAX_FRAMES must be a power of 2");
+
+        USART_ring<RX_LEN> rx;
+        USART_ring<TX_LEN> tx;
+
+        volatile char line_terminator;
+        volatile uint8_t line_count;                                // number of terminators (or complete frames) between tail and head
+        uint8_t peek_term;                                          // new tail once the peeked line is released
+        uint8_t peek_valid;
+
+        volatile uint8_t frame_mode;
+        volatile uint8_t frame_open;                                // characters have arrived since the last frame boundary
+        volatile uint8_t frame_start;                               // first character of the open frame
+        volatile uint8_t frame_end[USART_MAX_FRAMES];               // one past the last character of each complete frame
+        volatile uint8_t frame_head;
+        uint8_t frame_tail;
+
+        char filter[2][USART_FILTER_LEN];                           // accepted prefixes, see set_filter
+        volatile uint8_t filter_len;                                // 0 = no filter
+        volatile uint8_t filter_pos;                                // characters of the current line or frame compared so far
+        volatile uint8_t filter_match;                              // bit 0, 1 = still matches filter[0], filter[1]
+        volatile uint8_t filter_skip;                               // discarding the rest of a line or frame
+        volatile uint8_t line_start;                                // first character of the current line
+        volatile uint8_t overflow_skip;                             // discarding the rest of a line that overflowed the buffer
+
+        volatile USART_stats_t stats;
+
+        volatile uint8_t tx_busy;                                   // set on enqueue, cleared once the last stop bit is out
+        void (*TX_done)(void);                                      // called from the TXC ISR, see set_TX_done
+
+
+    /**
+     * @brief Place a single character in the transmit circular buffer and arm the UDRE interrupt.
+     * The call returns immediately unless the buffer is full.  In that case it waits for the ISR
+     * to make room for one character.
+     *
+     * @warning Global interrupts must be enabled.  Otherwise a full buffer will never drain.
+     */
+        void nb_putc(uint8_t c){
+
+            uint8_t next = tx.next(tx.head);
+
+            while (next == tx.tail){                                // buffer full - wait for the ISR
+                USART_WAIT();
+            }
+
+            tx.buf[tx.head] = c;
+            tx.head = next;
+            tx_busy = 0x01;
+            HW::regs().UCSRB |= (1 << UDRIE0);
+        }
+
+
+    /**
+     * @brief Compare the next line or frame from its first character.  Called with interrupts
+     * disabled.
+     */
+        __attribute__((always_inline)) inline void filter_restart(void){
+
+            filter_pos = 0;
+            filter_match = 0x03;
+            filter_skip = 0x00;
+            overflow_skip = 0x00;
+            line_start = rx.head;
+        }
+
+
+    /**
+     * @return c with a - z taken as A - Z
+     */
+        __attribute__((always_inline)) static inline uint8_t filter_fold(uint8_t c){
+
+            return ((c >= 'a') && (c <= 'z')) ? c - ('a' - 'A') : c;
+        }
+
+
+    /**
+     * @brief Compare a received character with the accepted prefixes.  On the first mismatch the
+     * characters of the line or frame already stored are taken back and the rest of it is
+     * discarded.
+     *
+     * @return 1 = store the character, 0 = discard it
+     */
+        __attribute__((always_inline)) inline uint8_t filter_accept(uint8_t c){
+
+            uint8_t f = c;
+            uint8_t a_1;
+            uint8_t a_2;
+
+            if (filter_skip){
+                if (!frame_mode && (c == line_terminator)){
+                    filter_restart();
+                }
+                return 0x00;
+            }
+            if (filter_pos >= filter_len){
+                return 0x01;
+            }
+
+            a_1 = filter[0][filter_pos];
+            a_2 = filter[1][filter_pos];
+            if (!frame_mode){
+                f = filter_fold(f);
+                a_1 = filter_fold(a_1);
+                a_2 = filter_fold(a_2);
+            }
+            if (f != a_1)
+                filter_match &= ~0x01;
+            if (f != a_2)
+                filter_match &= ~0x02;
+            filter_pos++;
+            if (filter_match){
+                return 0x01;
+            }
+
+            stats.filtered++;
+            if (frame_mode){
+                rx.head = frame_start;
+                frame_open = 0x00;
+                filter_skip = 0x01;                                 // until mark_frame
+            }
+            else{
+                rx.head = line_start;
+                if (c == line_terminator)
+                    filter_restart();
+                else
+                    filter_skip = 0x01;                             // until the terminator
+            }
+            return 0x00;
+        }
+    };
+
+#endif
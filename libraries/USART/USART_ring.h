@@ -0,0 +1,86 @@
+#ifndef _USART_RING_H
+
+    #define _USART_RING_H
+    #include <stdint.h>
+
+
+/**
+ * @brief Index arithmetic for a circular buffer of LEN characters.  LEN is a power of 2 so the
+ * modulo operation is a mask with LEN - 1.
+ */
+    template <uint16_t LEN> struct USART_ring_index {
+
+        static inline uint8_t next(uint8_t i){
+            return (i + 1) & (LEN - 1);
+        }
+
+        static inline uint8_t count(uint8_t head, uint8_t tail){
+            return (head - tail) & (LEN - 1);
+        }
+    };
+
+
+/**
+ * @brief A 256 character buffer needs no mask.  The uint8_t HEAD and TAIL roll over on their own.
+ */
+    template <> struct USART_ring_index<256> {
+
+        static inline uint8_t next(uint8_t i){
+            return i + 1;
+        }
+
+        static inline uint8_t count(uint8_t head, uint8_t tail){
+            return head - tail;
+        }
+    };
+
+
+/**
+ * @brief Circular buffer shared by the USART receive and transmit paths.
+ *
+ * The next character is inserted at HEAD and removed from TAIL.  HEAD == TAIL is empty.  One
+ * location is always left unused so that a full buffer (HEAD one behind TAIL) can be told apart
+ * from an empty one.  The buffer therefore holds LEN - 1 characters.
+ *
+ * @param LEN size of the buffer.  It must be a power of 2 from 2 through 256.  This is checked
+ *        at compile time.
+ *
+ * \b Example:
+ *    @code
+ *          USART_ring<128> rx;                                     // 128 bytes of RAM plus HEAD and TAIL
+ *
+ *          if (!rx.is_full()){
+ *              rx.buf[rx.head] = c;
+ *              rx.head = rx.next(rx.head);
+ *          }
+ *    @endcode
+ */
+    template <uint16_t LEN> struct USART_ring {
+
+        static_assert((LEN >= 2) && (LEN <= 256) && ((LEN & (LEN - 1)) == 0),
+            "USART_ring: LEN must be a power of 2 from 2 through 256");
+
+        static const uint16_t len = LEN;
+
+        volatile uint8_t buf[LEN];
+        volatile uint8_t head;
+        volatile uint8_t tail;
+
+        static inline uint8_t next(uint8_t i){
+            return USART_ring_index<LEN>::next(i);
+        }
+
+        inline uint8_t is_empty(void) const {
+            return head == tail;
+        }
+
+        inline uint8_t is_full(void) const {
+            return next(head) == tail;
+        }
+
+        inline uint8_t count(void) const {
+            return USART_ring_index<LEN>::count(head, tail);
+        }
+    };
+
+#endif
@@ -39,7 +39,9 @@
    // #include "line_parser.h"
     #include "ASCII_MODBUS.h"
     #include "GS1_support.h"
+    #include "MODBUS_cache.h"
     #include "USART.h"
+    #include "USART_instance.h"                                     // the USART driver - include once, in the sketch only
 #include "error.h"
 
 
@@ -77,17 +79,7 @@ void setup(){
  *
  ********************************************************************************/
 
-ISR(USART_RX_vect){
-
- /**
- * @note This Interrupt Service Routine is called when a new character is received by the USART.
- * Ideally it would have been placed in the USART.cpp file but there is a error "multiple definition
- * of vector_18".  Apparently Arduino detects when an ISR is in the main sketch.  If you place it
- * somewhere else it is missed and replaced with the Arduino handler.  This is the source of the
- * multiple definitions error -  * see discussion @ http://forum.arduino.cc/index.php?topic=42153.0
- */
-    USART_handle_ISR();
-}
+// The USART interrupt service routines are defined by USART_instance.h
 
 
 
@@ -120,10 +112,14 @@ void loop(){
         GS1_turn_on(GS1_ADDR);
         delay(1000);
 
-        for(uint16_t i = 50; i < 600; i++){
-            GS1_set_speed(GS1_ADDR, i);
-            delay(5);
+        for(uint16_t i = 50; i < 600; i++){                 // the bus sends the latest speed whenever it is free
+            MODBUS_cache_write(GS1_ADDR, Serial_Comm_Speed_Reference, i);
+            unsigned long start = millis();
+            while (millis() - start < 5){
+                MODBUS_cache_service();
+            }
         }
+        MODBUS_cache_flush();
 
         delay(4000);
         GS1_turn_off(GS1_ADDR);
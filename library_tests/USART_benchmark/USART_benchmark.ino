@@ -0,0 +1,242 @@
+/*
+ * Benchmark of the USART library.
+ *
+ * Copyright 2015 Aaron P. Dahlen       APDahlen@gmail.com
+ *
+ * This program is free software: you can redistribute it and/or modify it under the terms
+ * of the GNU General Public License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,but WITHOUT ANY WARRANTY;
+ * without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with this program.
+ * If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Connect a terminal to the Arduino at BAUD_RATE.  The results are printed once after reset.
+ *
+ *  1) Main loop time consumed while sending a 17 character MODBUS frame with the blocking
+ *     USART_puts and with the interrupt driven USART_nb_puts.
+ *
+ *  2) CPU cycles needed to determine if a complete line is waiting when the 128 byte receive
+ *     buffer is full and holds no terminator.  This is the worst case for the original scan of
+ *     the buffer.  The scan is reproduced below as old_is_string.  The cycles are counted with
+ *     Timer1 running at the CPU clock.
+ *
+ *  3) CPU cycles per received character spent in the receive ISR, including the interrupt
+ *     prologue and epilogue.  Build once as is (complete handler inline in the ISR) and once with
+ *     OUT_OF_LINE_ISR defined in configuration.h (ISR calls USART_handle_ISR) to compare.
+ */
+
+
+// AVR GCC libraries for more information see:
+//     http://www.nongnu.org/avr-libc/user-manual/modules.html
+//     https://www.gnu.org/software/libc/manual/
+
+    #include <avr/io.h>
+    #include <avr/interrupt.h>
+    #include <stdint.h>
+    #include <string.h>
+    #include <stdio.h>
+
+
+// Project specific includes
+
+    #include "configuration.h"
+    #include "USART.h"
+
+    #ifdef OUT_OF_LINE_ISR
+        #define USART_CUSTOM_ISR
+
+        void USART_handle_ISR(void) __attribute__((noinline));      // a real call, as from the original USART.cpp
+        void USART_handle_TX_ISR(void) __attribute__((noinline));
+    #endif
+
+    #include "USART_instance.h"                                     // the USART driver - include once, in the sketch only
+
+    #define STR(x) #x
+    #define XSTR(x) STR(x)
+
+
+// Global variables
+
+    char line[BUF_LEN];
+    char frame[] = ":0106091A00A03C\r\n";                          // 17 characters on the wire
+
+    volatile uint8_t old_buf[128];
+
+
+// Function declarations
+
+    uint8_t old_is_string(uint8_t tail, uint8_t head);
+    uint16_t cycles_is_string(uint8_t use_old);
+    uint16_t cycles_RX_ISR(void);
+
+
+void setup(){
+
+    unsigned long start;
+    unsigned long t_blocking = 0;
+    unsigned long t_non_blocking = 0;
+
+    USART_init(F_CLK, BAUD_RATE);
+    USART_set_terminator(LINE_TERMINATOR);
+
+    for (uint8_t i = 0; i < N_TRIALS; i++){
+
+        start = micros();
+        USART_puts(frame);
+        t_blocking += micros() - start;
+        delay(20);
+
+        start = micros();
+        USART_nb_puts(frame);
+        t_non_blocking += micros() - start;
+        USART_flush();
+        delay(20);
+    }
+
+    sprintf(line, "\nUSART_puts:    %lu uS per frame\n", t_blocking / N_TRIALS);
+    USART_puts(line);
+    sprintf(line, "USART_nb_puts: %lu uS per frame\n", t_non_blocking / N_TRIALS);
+    USART_puts(line);
+
+    TCCR1A = 0;                                                     // Timer1: normal mode, clk / 1
+    TCCR1B = (1 << CS10);
+
+    sprintf(line, "is_string scan:    %u cycles\n", cycles_is_string(1));
+    USART_puts(line);
+    sprintf(line, "is_string counter: %u cycles\n", cycles_is_string(0));
+    USART_puts(line);
+
+    #ifdef OUT_OF_LINE_ISR
+        sprintf(line, "RX ISR (calls USART_handle_ISR): %u cycles\n", cycles_RX_ISR());
+    #else
+        sprintf(line, "RX ISR (inline handler): %u cycles\n", cycles_RX_ISR());
+    #endif
+    USART_puts(line);
+}
+
+
+
+/**
+ * @brief The original USART_is_string.  It walks from TAIL toward HEAD looking for the terminator.
+ */
+uint8_t old_is_string(uint8_t tail, uint8_t head){
+
+    uint8_t result = 0x00;
+    uint8_t i = tail;
+
+    if (tail != head){
+        while (i != ((head + 127) & 0x7F)){
+            i++;
+            i &= 0x7F;
+            if (old_buf[i] == LINE_TERMINATOR){
+                result = 0x01;
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+
+
+/**
+ * @brief Count the cycles for one call of either version.  The buffer is full (HEAD one behind
+ * TAIL) and contains no terminator.  The cost of reading TCNT1 is subtracted.
+ */
+uint16_t cycles_is_string(uint8_t use_old){
+
+    uint16_t start;
+    uint16_t overhead;
+    uint16_t cycles;
+    uint8_t sreg = SREG;
+
+    memset((void *)old_buf, 'A', sizeof(old_buf));
+
+    cli();
+    start = TCNT1;
+    overhead = TCNT1 - start;
+
+    start = TCNT1;
+    if (use_old)
+        old_is_string(0, 127);
+    else
+        USART_is_string();
+    cycles = TCNT1 - start - overhead;
+    SREG = sreg;
+
+    return cycles;
+}
+
+
+
+/**
+ * @brief Count the cycles for one pass through the receive ISR.  The vector is called directly
+ * with interrupts disabled.  The RETI at the end of the ISR enables interrupts so they are
+ * disabled again immediately.  The ISR reads whatever is in UDR0.  That character is removed from
+ * the buffer afterward.
+ */
+uint16_t cycles_RX_ISR(void){
+
+    uint16_t start;
+    uint16_t overhead;
+    uint16_t cycles;
+
+    cli();
+    start = TCNT1;
+    overhead = TCNT1 - start;
+
+    start = TCNT1;
+    asm volatile ("call " XSTR(USART_RX_vect) "\n\t" "cli" ::: "memory");
+    cycles = TCNT1 - start - overhead;
+    sei();
+
+    USART_gets(line);
+    return cycles;
+}
+
+
+
+/*********************************************************************************
+ *  ______  ____   _____   ______  _____  _____    ____   _    _  _   _  _____
+ * |  ____|/ __ \ |  __ \ |  ____|/ ____||  __ \  / __ \ | |  | || \ | ||  __ \
+ * | |__  | |  | || |__) || |__  | |  __ | |__) || |  | || |  | ||  \| || |  | |
+ * |  __| | |  | ||  _  / |  __| | | |_ ||  _  / | |  | || |  | || . ` || |  | |
+ * | |    | |__| || | \ \ | |____| |__| || | \ \ | |__| || |__| || |\  || |__| |
+ * |_|     \____/ |_|  \_\|______|\_____||_|  \_\ \____/  \____/ |_| \_||_____/
+ *
+ ********************************************************************************/
+
+#ifdef OUT_OF_LINE_ISR
+
+ISR(USART_RX_vect){
+
+    USART_handle_ISR();
+}
+
+
+ISR(USART_UDRE_vect){
+
+    USART_handle_TX_ISR();
+}
+
+#endif
+
+
+
+/*********************************************************************************
+ *  ____            _____  _  __ _____  _____    ____   _    _  _   _  _____
+ * |  _ \    /\    / ____|| |/ // ____||  __ \  / __ \ | |  | || \ | ||  __ \
+ * | |_) |  /  \  | |     | ' /| |  __ | |__) || |  | || |  | ||  \| || |  | |
+ * |  _ <  / /\ \ | |     |  < | | |_ ||  _  / | |  | || |  | || . ` || |  | |
+ * | |_) |/ ____ \| |____ | . \| |__| || | \ \ | |__| || |__| || |\  || |__| |
+ * |____//_/    \_\\_____||_|\_\\_____||_|  \_\ \____/  \____/ |_| \_||_____/
+ *
+ ********************************************************************************/
+
+void loop(){
+
+}
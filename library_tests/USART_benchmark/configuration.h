@@ -0,0 +1,15 @@
+#ifndef configuration_H
+    #define configuration_H
+
+    #define F_CLK 16000000UL
+    #define BAUD_RATE 19200L
+
+    #define LINE_TERMINATOR 0x0A    // ASCII Line Feed
+
+    #define BUF_LEN 100
+
+    #define N_TRIALS 10
+
+  //#define OUT_OF_LINE_ISR         // uncomment to measure the ISR calling USART_handle_ISR (the original method)
+
+#endif